@@ -1,7 +1,9 @@
 #include <stdint.h>
 
-#define CRYPT_VERSION                   0x00000001
-#define CRYPT_VERSION_STRING            "v0.1"
+// 0x00000002: struct crypt_context gained keystream/keystream_pos, and key is no longer
+//  advanced by crypt_buffer(). Callers built against 0x00000001 must be rebuilt.
+#define CRYPT_VERSION                   0x00000002
+#define CRYPT_VERSION_STRING            "v0.2"
 
 // Maximum key length
 #define CRYPT_MAX_KEY_LEN               (uint8_t)(255)
@@ -17,23 +19,52 @@ enum {
     CRYPT_ERROR_ALREADY_RUNNING
 };
 
+// Precomputed keystream for one key, shared read-only between all contexts and
+//  crypt_alloc_keystream() handles created with that key. Opaque.
+struct crypt_keystream;
+
 // Cryptographic context, contains key state
 struct crypt_context {
     unsigned long                       version;
     const char                          *version_string;
     
-    // Key
+    // Key as supplied to crypt_alloc_context(), never modified by crypt_buffer()
     void                                *key;
     uint16_t                            key_size;
-    uint8_t                             key_state; // Holds the symmetric key state
+    uint8_t                             key_state; // Index of the next key byte, keystream_pos % key_size
+
+    // Shared keystream and this context's position in it
+    struct crypt_keystream              *keystream;
+    uint32_t                            keystream_pos;
+};
+
+// One record of a newline-delimited stream, see crypt_buffer_records()
+struct crypt_record {
+    uint64_t                            record;     // Record number, starting at 0
+    uint64_t                            offset;     // Stream offset of the first byte
+    uint64_t                            length;     // Length including the trailing newline
+};
+
+// Record framing state carried between crypt_buffer_records() calls, zero to start
+struct crypt_record_state {
+    uint64_t                            next_record;
+    uint64_t                            record_start;
+    uint64_t                            stream_pos;
 };
 
 // Creates a crypt_context structure. Caller must free using crypt_free_context(). 
+//  Contexts created with the same key share one cached keystream, which is computed
+//  on first use and released when the last such context is freed. Thread-safe.
 int32_t crypt_alloc_context(struct crypt_context **ctx_out, const void *key, uint8_t key_size);
 
 // Free up key and context
 void crypt_free_context(struct crypt_context *ctx);
 
+// Advance the key state as if len bytes had been passed through crypt_buffer()
+//  The key state repeats every (256 * key_size) bytes, so at most one period is walked
+//  regardless of len. Used to resume a stream at a known offset.
+int32_t crypt_advance_context(struct crypt_context *ctx, uint64_t len);
+
 // Primary cryptographic function 
 // Returns inputLen if all bytes were encrypted
 // Returns 0 if failure
@@ -45,5 +76,63 @@ uint32_t crypt_buffer(
     uint32_t inputLen
 );
 
+// Encrypt one input under several contexts (keys) in a single pass
+//  outputs[i] receives the output of ctxs[i], as if crypt_buffer() had been called once per
+//  context. The input is walked in cache-sized tiles and each tile is encrypted under every
+//  context before moving on, so it is read from memory once.
+//  Unlike crypt_buffer(), no outputs[i] may overlap input: encrypting in place would feed
+//  ciphertext of one context into the next. Overlapping outputs are rejected.
+//  Returns inputLen if all bytes were encrypted under all contexts, 0 on failure
+uint32_t crypt_buffer_multi(
+    struct crypt_context **ctxs,
+    uint8_t **outputs,
+    uint32_t count,
+    const uint8_t *input,
+    uint32_t inputLen
+);
+
+// Encrypt a newline-delimited stream and report the records that end in this buffer
+//  The buffer is encrypted as part of one continuous stream (as crypt_buffer()), with a
+//  single crypt_buffer() call. Each record ending in it is written to records, up to
+//  max_records, and their count to records_out. Any single record can later be decrypted
+//  on its own with crypt_buffer_at() at its offset.
+//  Returns the number of bytes consumed, less than inputLen if records filled up; call again
+//  with the remainder. Returns 0 on failure.
+uint32_t crypt_buffer_records(
+    struct crypt_context *ctx,
+    struct crypt_record_state *state,
+    uint8_t *output,
+    const uint8_t *input,
+    uint32_t inputLen,
+    struct crypt_record *records,
+    uint32_t max_records,
+    uint32_t *records_out
+);
+
+// At the end of the stream, report a final record that has no trailing newline
+//  Returns 1 if record_out was filled, 0 otherwise
+int32_t crypt_record_finish(struct crypt_record_state *state, struct crypt_record *record_out);
+
+// Creates a read-only keystream handle for key. Caller must free using crypt_free_keystream().
+//  The handle holds no position and is never modified, so any number of threads can call
+//  crypt_buffer_at() on it concurrently without locking. Shares the same cache as
+//  crypt_alloc_context().
+int32_t crypt_alloc_keystream(struct crypt_keystream **ks_out, const void *key, uint8_t key_size);
+
+// Release a keystream handle
+void crypt_free_keystream(struct crypt_keystream *ks);
+
+// Encrypt at an explicit stream offset
+//  Output equals what crypt_buffer() produces for the same bytes after offset bytes have
+//  already been passed through a fresh context. The caller tracks its own offset.
+//  Returns inputLen if all bytes were encrypted, same error values as crypt_buffer()
+uint32_t crypt_buffer_at(
+    const struct crypt_keystream *ks,
+    uint8_t *output,
+    const uint8_t *input,
+    uint32_t inputLen,
+    uint64_t offset
+);
+
 unsigned long crypt_get_version_long(void);
 const char *crypt_get_version_string(void);
\ No newline at end of file
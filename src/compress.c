@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "compress.h"
+
+// LZ77 in the style of LZ4. A block is a series of sequences:
+//  [token][literal length ext...][literals][offset: 2 bytes LE][match length ext...]
+//  The high nibble of the token is the literal length and the low nibble the match length
+//  minus LZ_MIN_MATCH, 15 in either means additional bytes follow, summed until one is < 255.
+//  The last sequence has literals only and ends the block.
+#define LZ_MIN_MATCH                                4
+#define LZ_HASH_BITS                                12
+#define LZ_HASH_SIZE                                (1 << LZ_HASH_BITS)
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// Writes a length continuation (the part that did not fit in the token nibble)
+static uint8_t *lz_write_length(uint8_t *op, const uint8_t *op_end, uint32_t len)
+{
+    for (; len >= 255; len -= 255) {
+        if (op >= op_end) {
+            return NULL;
+        }
+        *op++ = 255;
+    }
+
+    if (op >= op_end) {
+        return NULL;
+    }
+    *op++ = (uint8_t)len;
+
+    return op;
+}
+
+static uint8_t *lz_write_sequence(uint8_t *op, const uint8_t *op_end, const uint8_t *lit, uint32_t lit_len,
+    uint32_t offset, uint32_t match_len)
+{
+    if (op >= op_end) {
+        return NULL;
+    }
+
+    uint8_t *token = op++;
+    *token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+
+    if (lit_len >= 15 && !(op = lz_write_length(op, op_end, lit_len - 15))) {
+        return NULL;
+    }
+
+    if ((uint32_t)(op_end - op) < lit_len) {
+        return NULL;
+    }
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (match_len == 0) {
+        return op;
+    }
+
+    if (op_end - op < 2) {
+        return NULL;
+    }
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+
+    match_len -= LZ_MIN_MATCH;
+    *token |= (uint8_t)(match_len >= 15 ? 15 : match_len);
+
+    if (match_len >= 15 && !(op = lz_write_length(op, op_end, match_len - 15))) {
+        return NULL;
+    }
+
+    return op;
+}
+
+// Returns the compressed size, or 0 if it does not fit in out_max
+static uint32_t lz_compress(uint8_t *out, uint32_t out_max, const uint8_t *in, uint32_t in_size)
+{
+    // Positions + 1, so 0 means empty
+    uint16_t table[LZ_HASH_SIZE] = { 0 };
+
+    uint8_t *op = out;
+    const uint8_t *op_end = out + out_max;
+
+    uint32_t anchor = 0;
+    uint32_t pos = 0;
+
+    while (in_size >= LZ_MIN_MATCH && pos <= in_size - LZ_MIN_MATCH) {
+        const uint32_t seq = read32(in + pos);
+        const uint32_t h = lz_hash(seq);
+        const uint32_t candidate = table[h];
+        table[h] = (uint16_t)(pos + 1);
+
+        if (candidate == 0 || read32(in + candidate - 1) != seq) {
+            pos++;
+            continue;
+        }
+
+        const uint32_t ref = candidate - 1;
+        uint32_t match_len = LZ_MIN_MATCH;
+        while (pos + match_len < in_size && in[ref + match_len] == in[pos + match_len]) {
+            match_len++;
+        }
+
+        op = lz_write_sequence(op, op_end, in + anchor, pos - anchor, pos - ref, match_len);
+        if (!op) {
+            return 0;
+        }
+
+        pos += match_len;
+        anchor = pos;
+    }
+
+    op = lz_write_sequence(op, op_end, in + anchor, in_size - anchor, 0, 0);
+    if (!op) {
+        return 0;
+    }
+
+    return (uint32_t)(op - out);
+}
+
+// Reads a length continuation, returns false on truncated input
+static bool lz_read_length(const uint8_t **ip, const uint8_t *ip_end, uint32_t *len)
+{
+    uint8_t b;
+
+    do {
+        if (*ip >= ip_end) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+
+    return true;
+}
+
+// Returns false if the input is malformed or does not decompress to exactly out_size bytes
+static bool lz_decompress(uint8_t *out, uint32_t out_size, const uint8_t *in, uint32_t in_size)
+{
+    const uint8_t *ip = in;
+    const uint8_t *ip_end = in + in_size;
+    uint32_t op = 0;
+
+    while (ip < ip_end) {
+        const uint8_t token = *ip++;
+
+        uint32_t lit_len = token >> 4;
+        if (lit_len == 15 && !lz_read_length(&ip, ip_end, &lit_len)) {
+            return false;
+        }
+
+        if ((uint32_t)(ip_end - ip) < lit_len || out_size - op < lit_len) {
+            return false;
+        }
+        memcpy(out + op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        // Last sequence
+        if (ip == ip_end) {
+            break;
+        }
+
+        if (ip_end - ip < 2) {
+            return false;
+        }
+        const uint32_t offset = ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+
+        uint32_t match_len = token & 0x0f;
+        if (match_len == 15 && !lz_read_length(&ip, ip_end, &match_len)) {
+            return false;
+        }
+        match_len += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > op || out_size - op < match_len) {
+            return false;
+        }
+
+        // Byte by byte, matches may overlap the bytes being written
+        for (uint32_t i = 0; i < match_len; i++, op++) {
+            out[op] = out[op - offset];
+        }
+    }
+
+    return op == out_size;
+}
+
+uint32_t compress_frame(uint8_t *out, const uint8_t *in, uint32_t in_size)
+{
+    if (!out || !in || in_size == 0 || in_size > COMPRESS_BLOCK_SIZE) {
+        return 0;
+    }
+
+    uint8_t *payload = out + COMPRESS_FRAME_HEADER_SIZE;
+
+    // Only keep the compressed form if it is smaller
+    uint32_t payload_size = lz_compress(payload, in_size - 1, in, in_size);
+    uint8_t type = FRAME_TYPE_LZ;
+
+    if (payload_size == 0) {
+        memcpy(payload, in, in_size);
+        payload_size = in_size;
+        type = FRAME_TYPE_STORED;
+    }
+
+    out[0] = type;
+    out[1] = (uint8_t)(in_size & 0xff);
+    out[2] = (uint8_t)(in_size >> 8);
+    out[3] = (uint8_t)(payload_size & 0xff);
+    out[4] = (uint8_t)(payload_size >> 8);
+
+    return COMPRESS_FRAME_HEADER_SIZE + payload_size;
+}
+
+// Decode one complete frame
+static bool frame_decode(struct frame_reader *r, uint32_t raw_size, uint32_t payload_size, frame_block_cb cb, void *arg)
+{
+    const uint8_t *payload = r->frame + COMPRESS_FRAME_HEADER_SIZE;
+
+    switch (r->frame[0]) {
+    case FRAME_TYPE_STORED:
+        if (payload_size != raw_size) {
+            return false;
+        }
+        return cb(arg, payload, raw_size);
+
+    case FRAME_TYPE_LZ:
+        if (!lz_decompress(r->block, raw_size, payload, payload_size)) {
+            return false;
+        }
+        return cb(arg, r->block, raw_size);
+
+    default:
+        return false;
+    }
+}
+
+bool frame_reader_feed(struct frame_reader *r, const uint8_t *in, uint32_t in_size, frame_block_cb cb, void *arg)
+{
+    if (!r || !cb || (!in && in_size)) {
+        return false;
+    }
+
+    while (in_size > 0) {
+        // Header first, then the payload length it announces
+        uint32_t want = COMPRESS_FRAME_HEADER_SIZE;
+        uint32_t raw_size = 0, payload_size = 0;
+
+        if (r->frame_size >= COMPRESS_FRAME_HEADER_SIZE) {
+            raw_size = r->frame[1] | ((uint32_t)r->frame[2] << 8);
+            payload_size = r->frame[3] | ((uint32_t)r->frame[4] << 8);
+
+            if (raw_size == 0 || raw_size > COMPRESS_BLOCK_SIZE || payload_size == 0 || payload_size > COMPRESS_BLOCK_SIZE) {
+                return false;
+            }
+            want += payload_size;
+        }
+
+        uint32_t take = want - r->frame_size;
+        if (take > in_size) {
+            take = in_size;
+        }
+
+        memcpy(r->frame + r->frame_size, in, take);
+        r->frame_size += take;
+        in += take;
+        in_size -= take;
+
+        if (r->frame_size == want && want > COMPRESS_FRAME_HEADER_SIZE) {
+            r->frame_size = 0;
+            if (!frame_decode(r, raw_size, payload_size, cb, arg)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool frame_reader_complete(const struct frame_reader *r)
+{
+    return r && r->frame_size == 0;
+}
+
+//EOF
@@ -0,0 +1,41 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+// Fast LZ compression stage applied before crypt_buffer() (-z) and reverted after it (-d)
+//
+// Input is cut into blocks of at most COMPRESS_BLOCK_SIZE bytes and each block is written
+//  as a self-contained frame, so frames can be produced and consumed as a stream and
+//  compressed independently of each other:
+//      [type: 1 byte][raw length: 2 bytes LE][payload length: 2 bytes LE][payload]
+//  type is FRAME_TYPE_STORED when compression would not save space.
+
+// Uncompressed block size, offsets within a block always fit in 16 bits
+#define COMPRESS_BLOCK_SIZE                         (uint32_t)(0x8000)
+
+#define COMPRESS_FRAME_HEADER_SIZE                  5
+#define COMPRESS_FRAME_MAX_SIZE                     (COMPRESS_FRAME_HEADER_SIZE + COMPRESS_BLOCK_SIZE)
+
+#define FRAME_TYPE_STORED                           0x00
+#define FRAME_TYPE_LZ                               0x01
+
+// Called for every decompressed block, return false to stop
+typedef bool (*frame_block_cb)(void *arg, const uint8_t *block, uint32_t block_size);
+
+// Reassembles frames from arbitrarily sized pieces of a decrypted stream
+struct frame_reader {
+    uint8_t                         frame[COMPRESS_FRAME_MAX_SIZE];
+    uint32_t                        frame_size;
+    uint8_t                         block[COMPRESS_BLOCK_SIZE];
+};
+
+// Compress one block (at most COMPRESS_BLOCK_SIZE) into a frame
+//  out must hold COMPRESS_FRAME_MAX_SIZE bytes
+//  Returns the frame size, or 0 on failure
+uint32_t compress_frame(uint8_t *out, const uint8_t *in, uint32_t in_size);
+
+// Feed decrypted bytes, invoking cb for each complete frame
+//  Returns false if a frame is corrupt or cb fails
+bool frame_reader_feed(struct frame_reader *r, const uint8_t *in, uint32_t in_size, frame_block_cb cb, void *arg);
+
+// True if the stream ended on a frame boundary
+bool frame_reader_complete(const struct frame_reader *r);
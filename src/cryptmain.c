@@ -3,14 +3,20 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "libcryptprov.h"
 #include "cryptmain.h"
 #include "util.h"
+#include "trace.h"
+#include "inplace.h"
+#include "compress.h"
+#include "records.h"
+#include "throttle.h"
 
 // Parse the command line arguments into crypt_params
 //  This function will validate CLI parameters
-//  This function will read from target files and load them into memory
+//  This function will apply -p and -b, then read from target files and load them into memory
 //  This function will populate the key
 //  This function will block for stdin (i.e. key)
 //  stdin on the input file will not block
@@ -22,10 +28,38 @@ static int32_t mode_input_file(struct crypt_context *ctx, const struct crypt_par
 // Mode when there is no specified input file, and so block on stdin until EOF
 static int32_t mode_input_stdin(struct crypt_context *ctx, const struct crypt_params *params);
 
+// Mode when -i is specified, encrypt the target file in place with a resumable journal
+static int32_t mode_inplace(struct crypt_context *ctx, const struct crypt_params *params);
+
+// Mode when -r is specified, encrypt input as newline-delimited records and write the index
+static int32_t mode_records(struct crypt_context *ctx, const struct crypt_params *params);
+
+// Mode when -n is specified, decrypt a single record from the input file using the index
+static int32_t mode_extract_record(const struct crypt_params *params);
+
+// Mode when several keys and outputs are specified, encrypt the input under each key in one pass
+static int32_t mode_fanout(struct crypt_context *ctx, const struct crypt_params *params);
+
 // Write output buffer to either file or stdout
 //  0 returns an error
 static uint32_t write_output_buffer(const struct crypt_params *params, void *buf, uint32_t buf_size);
 
+// Write output buffer to path, or stdout if path is NULL
+//  0 returns an error
+static uint32_t write_output_path(const char *path, void *buf, uint32_t buf_size);
+
+// read_from_stdin(), counted against the -b rate limit
+static uint32_t read_input_stdin(uint8_t *buf, uint32_t buf_max_size);
+
+// Store a parsed key as the primary key, or as the next fan-out key
+static bool add_key(struct crypt_params *params, uint8_t *key, uint16_t key_size);
+
+// Compress a block into a frame, encrypt the frame and write it out
+static int32_t compress_and_write(struct crypt_context *ctx, const struct crypt_params *params, const uint8_t *block, uint32_t block_size);
+
+// frame_reader callback, writes a decompressed block to the output
+static bool write_block_cb(void *arg, const uint8_t *block, uint32_t block_size);
+
 // Free up all i/o buffers and parameters
 static void free_cli_params(struct crypt_params *p);
 
@@ -37,17 +71,20 @@ static void print_help(void);
 
 int32_t main(int32_t argc, char **argv)
 {
-    DEBUG_INFO(" [crypt] (v%s)", CRYPT_MAIN_VERSION);
-    DEBUG_INFO("libcryptprov version: %s (0x%08x)\n", crypt_get_version_string(), crypt_get_version_long());
-
     //
     // Parse command line parameters into params structure
+    //  Until the logger is started, messages go to stderr directly
     //
     struct crypt_params *params = parse_cli_and_load(argc, argv);
     if (!params || !params->key) {
         print_help();
         return -1;
     }
+
+    log_init(params->log_level, params->log_path);
+
+    DEBUG_INFO(" [crypt] (v%s)", CRYPT_MAIN_VERSION);
+    DEBUG_INFO("libcryptprov version: %s (0x%08x)\n", crypt_get_version_string(), crypt_get_version_long());
     print_cli_params(params);
 
     //
@@ -68,8 +105,22 @@ int32_t main(int32_t argc, char **argv)
     //  2) No input file was specified, therefore assume stdin, block on stdin unti EOF.
     //      Write from stdin to the cipher function in blocks until EOF is reached, preserving
     //      the context of the key and re-entering the function as data is received.
+    //  3) -i was specified, rewrite the target file in place, resuming from its journal
+    //      if a previous run was interrupted.
+    //  4) -r was specified, same as 1) and 2) but records are indexed, or with -n a single
+    //      record is decrypted from the input file
+    //  5) Several -k/-f and -o pairs were specified, same as 1) and 2) but the input is
+    //      encrypted under every key in one pass
     //
-    if (params->input_buffer) {
+    if (params->fanout_key_count) {
+        res = mode_fanout(crypt_ctx, params);
+    } else if (params->extract_record) {
+        res = mode_extract_record(params);
+    } else if (params->index_path) {
+        res = mode_records(crypt_ctx, params);
+    } else if (params->inplace_path) {
+        res = mode_inplace(crypt_ctx, params);
+    } else if (params->input_buffer) {
         res = mode_input_file(crypt_ctx, params);
     } else {
         res = mode_input_stdin(crypt_ctx, params);
@@ -85,7 +136,7 @@ int32_t main(int32_t argc, char **argv)
     DEBUG_INFO("Cleanup...");
     crypt_free_context(crypt_ctx);
     free_cli_params(params);
-    return 0;
+    return res;
 }
 
 static int32_t mode_input_file(struct crypt_context *ctx, const struct crypt_params *params)
@@ -94,17 +145,55 @@ static int32_t mode_input_file(struct crypt_context *ctx, const struct crypt_par
         return -1;
     }
 
+    if (params->compress) {
+        // Each block becomes its own frame
+        for (uint32_t pos = 0; pos < params->input_buffer_size; pos += COMPRESS_BLOCK_SIZE) {
+            uint32_t block_size = params->input_buffer_size - pos;
+            if (block_size > COMPRESS_BLOCK_SIZE) {
+                block_size = COMPRESS_BLOCK_SIZE;
+            }
+
+            if (compress_and_write(ctx, params, params->input_buffer + pos, block_size)) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
     uint8_t *out_buf = (uint8_t *)calloc(params->input_buffer_size, sizeof(uint8_t));
     if (!out_buf) {
         DEBUG_ERR("mode_input_file: out of memory");
         return -1;
     }
 
+    CRYPT_TRACE1(crypt, encrypt_start, params->input_buffer_size);
     uint32_t res = crypt_buffer(ctx, out_buf, params->input_buffer, params->input_buffer_size);
+    CRYPT_TRACE1(crypt, encrypt_done, res);
     if (res != params->input_buffer_size) {
         return res;
     }
 
+    if (params->decompress) {
+        struct frame_reader *reader = (struct frame_reader *)calloc(1, sizeof(struct frame_reader));
+        if (!reader) {
+            DEBUG_ERR("mode_input_file: out of memory");
+            free(out_buf);
+            return -1;
+        }
+
+        const bool ok = frame_reader_feed(reader, out_buf, params->input_buffer_size, write_block_cb, (void *)params) &&
+            frame_reader_complete(reader);
+
+        free(reader);
+        free(out_buf);
+
+        if (!ok) {
+            DEBUG_ERR("mode_input_file: input is not a valid compressed stream, or the key is wrong");
+            return -1;
+        }
+        return 0;
+    }
+
     res = write_output_buffer(params, out_buf, params->input_buffer_size);
     if (res != params->input_buffer_size) {
         DEBUG_ERR("mode_input_file: failed to write file to: %s", 
@@ -123,59 +212,424 @@ static int32_t mode_input_stdin(struct crypt_context *ctx, const struct crypt_pa
         return -1;
     }
 
-    uint8_t stdin_buf[CRYPT_STDIN_BUF_SIZE];
+    // Compression works on whole blocks, otherwise stdin is passed through in small chunks
+    const uint32_t chunk_size = params->compress ? COMPRESS_BLOCK_SIZE : CRYPT_STDIN_BUF_SIZE;
+
+    uint8_t *stdin_buf = (uint8_t *)malloc(chunk_size);
+    struct frame_reader *reader = NULL;
+    if (params->decompress) {
+        reader = (struct frame_reader *)calloc(1, sizeof(struct frame_reader));
+    }
+
+    if (!stdin_buf || (params->decompress && !reader)) {
+        DEBUG_ERR("mode_input_stdin: out of memory");
+        free(stdin_buf);
+        free(reader);
+        return -1;
+    }
+
+    int32_t ret = 0;
     uint32_t total_read = 0;
 
     fflush(stdin);
     fflush(stdout);
     for (;;) {
-        memset(stdin_buf, 0x00, CRYPT_STDIN_BUF_SIZE);
-        uint32_t stdin_buf_read = read_from_stdin(stdin_buf, CRYPT_STDIN_BUF_SIZE);
+        memset(stdin_buf, 0x00, chunk_size);
+        CRYPT_TRACE1(crypt, read_start, chunk_size);
+        uint32_t stdin_buf_read = read_input_stdin(stdin_buf, chunk_size);
+        CRYPT_TRACE1(crypt, read_done, stdin_buf_read);
         total_read += stdin_buf_read;
 
-        // Just write to the same buffer
-        crypt_buffer(ctx, stdin_buf, stdin_buf, stdin_buf_read);
-
-        uint32_t res = write_output_buffer(params, stdin_buf, stdin_buf_read);
-        if (res != stdin_buf_read) {
-            DEBUG_ERR("Failed to write to stream: 0x%08x", res);
+        if (params->compress) {
+            if (stdin_buf_read && compress_and_write(ctx, params, stdin_buf, stdin_buf_read)) {
+                ret = -1;
+                break;
+            }
+        } else {
+            // Just write to the same buffer
+            CRYPT_TRACE1(crypt, encrypt_start, stdin_buf_read);
+            crypt_buffer(ctx, stdin_buf, stdin_buf, stdin_buf_read);
+            CRYPT_TRACE1(crypt, encrypt_done, stdin_buf_read);
+
+            if (reader) {
+                if (!frame_reader_feed(reader, stdin_buf, stdin_buf_read, write_block_cb, (void *)params)) {
+                    DEBUG_ERR("mode_input_stdin: input is not a valid compressed stream, or the key is wrong");
+                    ret = -1;
+                    break;
+                }
+            } else {
+                uint32_t res = write_output_buffer(params, stdin_buf, stdin_buf_read);
+                if (res != stdin_buf_read) {
+                    DEBUG_ERR("Failed to write to stream: 0x%08x", res);
+                }
+            }
         }
 
         // Have we reached an EOF?
-        if (stdin_buf_read < CRYPT_STDIN_BUF_SIZE) {
+        if (stdin_buf_read < chunk_size) {
             break;
         }
     }
+
+    if (!ret && reader && !frame_reader_complete(reader)) {
+        DEBUG_ERR("mode_input_stdin: compressed stream is truncated");
+        ret = -1;
+    }
     
     DEBUG_INFO("mode_input_stdin: total read: %d", total_read);
+
+    memset(stdin_buf, 0x00, chunk_size);
+    free(stdin_buf);
+    free(reader);
+    return ret;
+}
+
+static int32_t compress_and_write(struct crypt_context *ctx, const struct crypt_params *params, const uint8_t *block, uint32_t block_size)
+{
+    uint8_t frame[COMPRESS_FRAME_MAX_SIZE];
+
+    const uint32_t frame_size = compress_frame(frame, block, block_size);
+    if (!frame_size) {
+        DEBUG_ERR("compress_and_write: failed to compress block (size: %d)", block_size);
+        return -1;
+    }
+
+    CRYPT_TRACE1(crypt, encrypt_start, frame_size);
+    const uint32_t res = crypt_buffer(ctx, frame, frame, frame_size);
+    CRYPT_TRACE1(crypt, encrypt_done, res);
+    if (res != frame_size) {
+        return -1;
+    }
+
+    if (write_output_buffer(params, frame, frame_size) != frame_size) {
+        DEBUG_ERR("compress_and_write: failed to write frame to: %s",
+            params->output_buffer_path ? params->output_buffer_path : "stdout");
+        return -1;
+    }
+
+    return 0;
+}
+
+static bool write_block_cb(void *arg, const uint8_t *block, uint32_t block_size)
+{
+    const struct crypt_params *params = (const struct crypt_params *)arg;
+
+    return write_output_buffer(params, (void *)block, block_size) == block_size;
+}
+
+// Encrypt one chunk of records, write the ciphertext and append its index entries
+static int32_t records_chunk(struct crypt_context *ctx, const struct crypt_params *params,
+    struct crypt_record_state *state, uint8_t *out_buf, const uint8_t *in, uint32_t in_size)
+{
+    struct crypt_record records[CRYPT_RECORD_BATCH];
+
+    while (in_size > 0) {
+        uint32_t count = 0;
+
+        CRYPT_TRACE1(crypt, encrypt_start, in_size);
+        const uint32_t consumed = crypt_buffer_records(ctx, state, out_buf, in, in_size, records, CRYPT_RECORD_BATCH, &count);
+        CRYPT_TRACE1(crypt, encrypt_done, consumed);
+        if (!consumed) {
+            return -1;
+        }
+
+        if (write_output_buffer(params, out_buf, consumed) != consumed) {
+            DEBUG_ERR("records_chunk: failed to write to: %s",
+                params->output_buffer_path ? params->output_buffer_path : "stdout");
+            return -1;
+        }
+
+        if (!records_write_index(params->index_path, records, count)) {
+            return -1;
+        }
+
+        in += consumed;
+        in_size -= consumed;
+    }
+
     return 0;
 }
 
+static int32_t mode_records(struct crypt_context *ctx, const struct crypt_params *params)
+{
+    if (!ctx || !params || !params->index_path) {
+        return -1;
+    }
+
+    // Index offsets start at 0 for every run, so the index must be new and the output must
+    //  not already hold a previous stream that write_to_file() would append to
+    if (!records_create_index(params->index_path)) {
+        return -1;
+    }
+
+    if (params->output_buffer_path) {
+        FILE *fp = fopen(params->output_buffer_path, "wb");
+        if (!fp) {
+            DEBUG_ERR("mode_records: failed to truncate %s", params->output_buffer_path);
+            return -1;
+        }
+        fclose(fp);
+    }
+
+    uint8_t *in_buf = (uint8_t *)malloc(CRYPT_RECORD_BUF_SIZE);
+    uint8_t *out_buf = (uint8_t *)malloc(CRYPT_RECORD_BUF_SIZE);
+    if (!in_buf || !out_buf) {
+        DEBUG_ERR("mode_records: out of memory");
+        free(in_buf);
+        free(out_buf);
+        return -1;
+    }
+
+    struct crypt_record_state state = { 0 };
+    int32_t ret = 0;
+
+    if (params->input_buffer) {
+        for (uint32_t pos = 0; !ret && pos < params->input_buffer_size; pos += CRYPT_RECORD_BUF_SIZE) {
+            uint32_t chunk = params->input_buffer_size - pos;
+            if (chunk > CRYPT_RECORD_BUF_SIZE) {
+                chunk = CRYPT_RECORD_BUF_SIZE;
+            }
+            ret = records_chunk(ctx, params, &state, out_buf, params->input_buffer + pos, chunk);
+        }
+    } else {
+        for (;;) {
+            CRYPT_TRACE1(crypt, read_start, CRYPT_RECORD_BUF_SIZE);
+            const uint32_t stdin_buf_read = read_input_stdin(in_buf, CRYPT_RECORD_BUF_SIZE);
+            CRYPT_TRACE1(crypt, read_done, stdin_buf_read);
+
+            ret = records_chunk(ctx, params, &state, out_buf, in_buf, stdin_buf_read);
+            if (ret || stdin_buf_read < CRYPT_RECORD_BUF_SIZE) {
+                break;
+            }
+        }
+    }
+
+    // Last record without a trailing newline
+    struct crypt_record last;
+    if (!ret && crypt_record_finish(&state, &last) && !records_write_index(params->index_path, &last, 1)) {
+        ret = -1;
+    }
+
+    DEBUG_INFO("mode_records: %llu records, %llu bytes, index: %s", (unsigned long long)state.next_record,
+        (unsigned long long)state.stream_pos, params->index_path);
+
+    memset(in_buf, 0x00, CRYPT_RECORD_BUF_SIZE);
+    memset(out_buf, 0x00, CRYPT_RECORD_BUF_SIZE);
+    free(in_buf);
+    free(out_buf);
+    return ret;
+}
+
+static int32_t mode_extract_record(const struct crypt_params *params)
+{
+    if (!params || !params->index_path || !params->input_path) {
+        return -1;
+    }
+
+    struct crypt_record record;
+    if (!records_read_index(params->index_path, params->record_number, &record)) {
+        DEBUG_ERR("mode_extract_record: record %llu is not in %s", (unsigned long long)params->record_number, params->index_path);
+        return -1;
+    }
+
+    struct crypt_keystream *ks = NULL;
+    if (crypt_alloc_keystream(&ks, params->key, params->key_size) != CRYPT_ERROR_OK) {
+        DEBUG_ERR("mode_extract_record: failed to create keystream");
+        return -1;
+    }
+
+    uint8_t *buf = (uint8_t *)malloc(CRYPT_RECORD_BUF_SIZE);
+    if (!buf) {
+        DEBUG_ERR("mode_extract_record: out of memory");
+        crypt_free_keystream(ks);
+        return -1;
+    }
+
+    // Position the keystream at the record, nothing before it is read
+    int32_t ret = 0;
+    for (uint64_t done = 0; done < record.length; ) {
+        uint32_t chunk = CRYPT_RECORD_BUF_SIZE;
+        if (record.length - done < chunk) {
+            chunk = (uint32_t)(record.length - done);
+        }
+
+        if (!records_read_at(params->input_path, record.offset + done, buf, chunk)) {
+            DEBUG_ERR("mode_extract_record: failed to read %s at offset %llu", params->input_path,
+                (unsigned long long)(record.offset + done));
+            ret = -1;
+            break;
+        }
+
+        if (crypt_buffer_at(ks, buf, buf, chunk, record.offset + done) != chunk ||
+                write_output_buffer(params, buf, chunk) != chunk) {
+            ret = -1;
+            break;
+        }
+
+        done += chunk;
+    }
+
+    memset(buf, 0x00, CRYPT_RECORD_BUF_SIZE);
+    free(buf);
+    crypt_free_keystream(ks);
+    return ret;
+}
+
+static int32_t mode_fanout(struct crypt_context *ctx, const struct crypt_params *params)
+{
+    if (!ctx || !params || !params->fanout_key_count) {
+        return -1;
+    }
+
+    const uint32_t count = params->fanout_key_count + 1;
+
+    struct crypt_context *ctxs[CRYPT_MAX_FANOUT + 1] = { ctx };
+    uint8_t *outputs[CRYPT_MAX_FANOUT + 1] = { NULL };
+    const char *paths[CRYPT_MAX_FANOUT + 1] = { params->output_buffer_path };
+
+    uint8_t *in_buf = (uint8_t *)malloc(CRYPT_FANOUT_BUF_SIZE);
+    int32_t ret = in_buf ? 0 : -1;
+
+    for (uint32_t k = 0; !ret && k < count; k++) {
+        outputs[k] = (uint8_t *)malloc(CRYPT_FANOUT_BUF_SIZE);
+        if (!outputs[k]) {
+            ret = -1;
+            break;
+        }
+
+        if (k > 0) {
+            paths[k] = params->fanout_output_path[k - 1];
+            if (crypt_alloc_context(&ctxs[k], params->fanout_key[k - 1], params->fanout_key_size[k - 1]) != CRYPT_ERROR_OK) {
+                DEBUG_ERR("mode_fanout: failed to initialize context for key %d", k);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret) {
+        DEBUG_ERR("mode_fanout: failed to set up %d outputs", count);
+    }
+
+    uint64_t total = 0;
+
+    // Each chunk is read once and encrypted under every key while it is in cache
+    for (uint32_t pos = 0; !ret; ) {
+        const uint8_t *in = NULL;
+        uint32_t in_size = 0;
+
+        if (params->input_buffer) {
+            in_size = params->input_buffer_size - pos;
+            if (in_size > CRYPT_FANOUT_BUF_SIZE) {
+                in_size = CRYPT_FANOUT_BUF_SIZE;
+            }
+            in = params->input_buffer + pos;
+            pos += in_size;
+        } else {
+            CRYPT_TRACE1(crypt, read_start, CRYPT_FANOUT_BUF_SIZE);
+            in_size = read_input_stdin(in_buf, CRYPT_FANOUT_BUF_SIZE);
+            CRYPT_TRACE1(crypt, read_done, in_size);
+            in = in_buf;
+        }
+
+        if (in_size == 0) {
+            break;
+        }
+
+        CRYPT_TRACE1(crypt, encrypt_start, in_size);
+        const uint32_t res = crypt_buffer_multi(ctxs, outputs, count, in, in_size);
+        CRYPT_TRACE1(crypt, encrypt_done, res);
+        if (res != in_size) {
+            ret = -1;
+            break;
+        }
+
+        for (uint32_t k = 0; k < count; k++) {
+            if (write_output_path(paths[k], outputs[k], in_size) != in_size) {
+                DEBUG_ERR("mode_fanout: failed to write to: %s", paths[k] ? paths[k] : "stdout");
+                ret = -1;
+                break;
+            }
+        }
+
+        total += in_size;
+
+        if (!params->input_buffer && in_size < CRYPT_FANOUT_BUF_SIZE) {
+            break;
+        }
+    }
+
+    DEBUG_INFO("mode_fanout: %llu bytes encrypted under %d keys", (unsigned long long)total, count);
+
+    // ctxs[0] belongs to main()
+    for (uint32_t k = 0; k < count; k++) {
+        if (k > 0) {
+            crypt_free_context(ctxs[k]);
+        }
+        if (outputs[k]) {
+            memset(outputs[k], 0x00, CRYPT_FANOUT_BUF_SIZE);
+            free(outputs[k]);
+        }
+    }
+    free(in_buf);
+    return ret;
+}
+
+static int32_t mode_inplace(struct crypt_context *ctx, const struct crypt_params *params)
+{
+    if (!ctx || !params || !params->inplace_path) {
+        return -1;
+    }
+
+    return crypt_file_inplace(ctx, params->inplace_path, params->key, params->key_size);
+}
+
 static uint32_t write_output_buffer(const struct crypt_params *params, void *buf, uint32_t buf_size)
 {
-    if (!params || !buf || buf_size == 0) {
+    if (!params) {
         return 0;
     }
 
-    if (params->output_buffer_path) {
+    return write_output_path(params->output_buffer_path, buf, buf_size);
+}
+
+static uint32_t write_output_path(const char *path, void *buf, uint32_t buf_size)
+{
+    if (!buf || buf_size == 0) {
+        return 0;
+    }
+
+    CRYPT_TRACE1(crypt, write_start, buf_size);
+
+    if (path) {
         // Write the output buffer to a file path specified by CLI
         // Default behaviour is to append to a file if it exists,
         // or create it if it does not        
-        const uint32_t bytes_written = write_to_file(params->output_buffer_path, buf, buf_size);
+        const uint32_t bytes_written = write_to_file(path, buf, buf_size);
+        throttle_write(bytes_written);
         if (bytes_written != buf_size) {
             DEBUG_ERR("Failed to write file: %d written (%d expected)", bytes_written, buf_size);
+            CRYPT_TRACE1(crypt, write_done, bytes_written);
             return bytes_written;
         }
-        DEBUG_INFO("Written output to file %s (size: %d)", params->output_buffer_path, buf_size);
+        DEBUG_VERBOSE("Written output to file %s (size: %d)", path, buf_size);
     } else {
         // Otherwise, write to stdout
         fflush(stdout);
         fwrite(buf, 1, buf_size, stdout);
+        throttle_write(buf_size);
     }
 
+    CRYPT_TRACE1(crypt, write_done, buf_size);
     return buf_size;
 }
 
+static uint32_t read_input_stdin(uint8_t *buf, uint32_t buf_max_size)
+{
+    const uint32_t total_read = read_from_stdin(buf, buf_max_size);
+    throttle_read(total_read);
+    return total_read;
+}
+
 static void print_cli_params(const struct crypt_params *p)
 {
     if (!p) {
@@ -190,7 +644,9 @@ static void print_cli_params(const struct crypt_params *p)
         DEBUG_INFO("input_buf: stdin");
     }
 
-    if (p->output_buffer_path) {
+    if (p->inplace_path) {
+        DEBUG_INFO("inplace_path: %s", p->inplace_path);
+    } else if (p->output_buffer_path) {
         DEBUG_INFO("output_buf_path: %s", p->output_buffer_path);
     } else {
         DEBUG_INFO("output_buf_path: stdout");
@@ -205,6 +661,7 @@ static struct crypt_params *parse_cli_and_load(int32_t argc, char *argv[])
     }
 
     struct crypt_params *params = (struct crypt_params *)calloc(sizeof(struct crypt_params), sizeof(uint8_t));
+    params->log_level = LOG_LEVEL_INFO;
 
     uint8_t *buf = NULL;
     uint32_t buf_size = 0;
@@ -215,12 +672,7 @@ static struct crypt_params *parse_cli_and_load(int32_t argc, char *argv[])
             goto params_fail;
 
         } else if (!strncmp("-k", argv[curr_arg], 2)) {
-            // Read key from command line arg
-
-            if (params->key) {
-                DEBUG_ERR("Key parameter already set, exiting");
-                goto params_fail;
-            }
+            // Read key from command line arg, repeated -k/-f add fan-out keys
 
             buf_size = strnlen(argv[curr_arg + 1], CRYPT_MAX_KEY_LEN);
 
@@ -231,21 +683,17 @@ static struct crypt_params *parse_cli_and_load(int32_t argc, char *argv[])
 
             // We need to allocate a buffer for the key, since key might come from a file 
             //  and a crash will happen trying to free() an element of argv[]
-            params->key = (uint8_t *)malloc(buf_size);
-            memcpy(params->key, argv[curr_arg + 1], buf_size);
-            params->key_size = buf_size;
+            buf = (uint8_t *)malloc(buf_size);
+            memcpy(buf, argv[curr_arg + 1], buf_size);
+            if (!add_key(params, buf, buf_size)) {
+                goto params_fail;
+            }
 
             curr_arg++;
             continue;
 
         } else if (!strncmp("-f", argv[curr_arg], 2)) {
-            // Read key from file
-
-            // If the params->key buffer already exists, then -k and -f were used together, return help output
-            if (params->key) {
-                DEBUG_ERR("Key parameter already set, exiting");
-                goto params_fail;
-            }
+            // Read key from file, repeated -k/-f add fan-out keys
 
             // Validate file path for "-f"
             if ((curr_arg + 1) >= argc || !is_path_valid(argv[curr_arg + 1])) {
@@ -260,8 +708,15 @@ static struct crypt_params *parse_cli_and_load(int32_t argc, char *argv[])
                 goto params_fail;
             }
 
-            params->key = buf;
-            params->key_size = buf_size;
+            if (buf_size >= CRYPT_MAX_KEY_LEN) {
+                DEBUG_ERR("Key file for -f is too large: %s", argv[curr_arg + 1]);
+                free(buf);
+                goto params_fail;
+            }
+
+            if (!add_key(params, buf, buf_size)) {
+                goto params_fail;
+            }
 
             curr_arg++;
             continue;
@@ -275,20 +730,145 @@ static struct crypt_params *parse_cli_and_load(int32_t argc, char *argv[])
                 goto params_fail;
             }
 
-            // `-o -` is provided, then used stdout is to be used
-            if (argv[curr_arg + 1][0] == '-') {
-                curr_arg++;
-                continue;
-            }    
-            
-            params->output_buffer_path = (char *)calloc(path_len + sizeof('\0'), sizeof(char));
-            memcpy(params->output_buffer_path, argv[curr_arg + 1], path_len);
+            // `-o -` is provided, then used stdout is to be used, kept as a NULL path so
+            //  repeated -o still pair up with their keys
+            char *path = NULL;
+            if (argv[curr_arg + 1][0] != '-') {
+                path = (char *)calloc(path_len + sizeof('\0'), sizeof(char));
+                memcpy(path, argv[curr_arg + 1], path_len);
+            }
+
+            // Repeated -o pair up with fan-out keys in order
+            if (++params->output_count == 1) {
+                params->output_buffer_path = path;
+            } else if (params->fanout_output_count < CRYPT_MAX_FANOUT) {
+                params->fanout_output_path[params->fanout_output_count++] = path;
+            } else {
+                DEBUG_ERR("Too many -o parameters, at most %d", CRYPT_MAX_FANOUT + 1);
+                free(path);
+                goto params_fail;
+            }
+
+            curr_arg++;
+            continue;
+
+        } else if (!strncmp("-z", argv[curr_arg], 2)) {
+            params->compress = true;
+            continue;
+
+        } else if (!strncmp("-d", argv[curr_arg], 2)) {
+            params->decompress = true;
+            continue;
+
+        } else if (!strncmp("-b", argv[curr_arg], 2)) {
+            // Bandwidth limit, bytes per second with an optional K, M or G suffix
+
+            if ((curr_arg + 1) >= argc || !throttle_parse_rate(argv[curr_arg + 1], &params->rate_limit)) {
+                DEBUG_ERR("Invalid parameter for -b");
+                goto params_fail;
+            }
+
+            curr_arg++;
+            continue;
+
+        } else if (!strncmp("-p", argv[curr_arg], 2)) {
+            // Priority class: normal, low or idle
+
+            if ((curr_arg + 1) >= argc || !throttle_parse_priority(argv[curr_arg + 1], &params->priority)) {
+                DEBUG_ERR("Invalid parameter for -p, expected normal, low or idle");
+                goto params_fail;
+            }
+
+            curr_arg++;
+            continue;
+
+        } else if (!strncmp("-v", argv[curr_arg], 2)) {
+            params->log_level = LOG_LEVEL_DEBUG;
+            continue;
+
+        } else if (!strncmp("-q", argv[curr_arg], 2)) {
+            params->log_level = LOG_LEVEL_ERROR;
+            continue;
+
+        } else if (!strncmp("-l", argv[curr_arg], 2)) {
+            // Log file, created if it does not exist and appended to otherwise
+
+            if (params->log_path || (curr_arg + 1) >= argc) {
+                DEBUG_ERR("Invalid parameter for -l");
+                goto params_fail;
+            }
+
+            const uint32_t path_len = strnlen(argv[curr_arg + 1], MAX_FILE_PATH);
+            if (path_len == 0 || path_len >= MAX_FILE_PATH) {
+                DEBUG_ERR("Invalid parameter for -l");
+                goto params_fail;
+            }
+
+            params->log_path = (char *)calloc(path_len + sizeof('\0'), sizeof(char));
+            memcpy(params->log_path, argv[curr_arg + 1], path_len);
+
+            curr_arg++;
+            continue;
+
+        } else if (!strncmp("-i", argv[curr_arg], 2)) {
+            // Target file for in-place mode, must exist and is not loaded into memory
+
+            if (params->inplace_path || (curr_arg + 1) >= argc || !is_path_valid(argv[curr_arg + 1])) {
+                DEBUG_ERR("Invalid parameter for -i, or path not valid");
+                goto params_fail;
+            }
+
+            const uint32_t path_len = strnlen(argv[curr_arg + 1], MAX_FILE_PATH);
+            params->inplace_path = (char *)calloc(path_len + sizeof('\0'), sizeof(char));
+            memcpy(params->inplace_path, argv[curr_arg + 1], path_len);
+
+            curr_arg++;
+            continue;
+
+        } else if (!strncmp("-r", argv[curr_arg], 2)) {
+            // Record index file, written when encrypting and read with -n
+
+            if (params->index_path || (curr_arg + 1) >= argc) {
+                DEBUG_ERR("Invalid parameter for -r");
+                goto params_fail;
+            }
+
+            const uint32_t path_len = strnlen(argv[curr_arg + 1], MAX_FILE_PATH);
+            if (path_len == 0 || path_len >= MAX_FILE_PATH) {
+                DEBUG_ERR("Invalid parameter for -r");
+                goto params_fail;
+            }
+
+            params->index_path = (char *)calloc(path_len + sizeof('\0'), sizeof(char));
+            memcpy(params->index_path, argv[curr_arg + 1], path_len);
+
+            curr_arg++;
+            continue;
+
+        } else if (!strncmp("-n", argv[curr_arg], 2)) {
+            // Record number to extract
+
+            char *end = NULL;
+            if (params->extract_record || (curr_arg + 1) >= argc) {
+                DEBUG_ERR("Invalid parameter for -n");
+                goto params_fail;
+            }
+
+            // strtoull() accepts a sign and wraps "-1" around, so only digits are allowed
+            const char *record_arg = argv[curr_arg + 1];
+            errno = 0;
+            params->record_number = strtoull(record_arg, &end, 10);
+            if (record_arg[0] < '0' || record_arg[0] > '9' || errno == ERANGE || !end || *end != '\0') {
+                DEBUG_ERR("Invalid record number for -n: %s", argv[curr_arg + 1]);
+                goto params_fail;
+            }
+            params->extract_record = true;
 
             curr_arg++;
             continue;
 
         } else {
-            if (params->input_buffer) {
+            if (params->input_path) {
                 goto params_fail;
             }
 
@@ -298,15 +878,10 @@ static struct crypt_params *parse_cli_and_load(int32_t argc, char *argv[])
                 goto params_fail;
             }
 
-            // Read file specified for -f into heap
-            buf_size = read_file_into_memory(argv[curr_arg], &buf);
-            if (!buf_size) {
-                DEBUG_ERR("Invalid path for -f: %s", argv[curr_arg + 1]);
-                goto params_fail;
-            }
-
-            params->input_buffer = buf;
-            params->input_buffer_size = buf_size;
+            // Loaded after all arguments are parsed, -n reads the file in place instead
+            const uint32_t path_len = strnlen(argv[curr_arg], MAX_FILE_PATH);
+            params->input_path = (char *)calloc(path_len + sizeof('\0'), sizeof(char));
+            memcpy(params->input_path, argv[curr_arg], path_len);
 
             curr_arg++;
             continue;
@@ -316,6 +891,87 @@ static struct crypt_params *parse_cli_and_load(int32_t argc, char *argv[])
         goto params_fail;
     }
 
+    if (params->inplace_path && (params->input_buffer || params->output_buffer_path || params->compress || params->decompress)) {
+        DEBUG_ERR("-i cannot be combined with -o, -z, -d or an input file");
+        goto params_fail;
+    }
+
+    if (params->compress && params->decompress) {
+        DEBUG_ERR("-z and -d are mutually exclusive");
+        goto params_fail;
+    }
+
+    if (params->fanout_key_count != params->fanout_output_count ||
+            (params->fanout_key_count && !params->output_count)) {
+        DEBUG_ERR("Each key needs its own output file when more than one key is given");
+        goto params_fail;
+    }
+
+    if (params->fanout_key_count) {
+        // Outputs are appended to chunk by chunk, two keys sharing one output would interleave
+        const char *paths[CRYPT_MAX_FANOUT + 1] = { params->output_buffer_path };
+        for (uint32_t i = 0; i < params->fanout_output_count; i++) {
+            paths[i + 1] = params->fanout_output_path[i];
+        }
+
+        for (uint32_t i = 0; i <= params->fanout_output_count; i++) {
+            for (uint32_t k = 0; k < i; k++) {
+                if (!paths[i] && !paths[k]) {
+                    DEBUG_ERR("Only one key can be written to stdout (-o -) when more than one key is given");
+                    goto params_fail;
+                }
+
+                if (paths[i] && paths[k] && !strcmp(paths[i], paths[k])) {
+                    DEBUG_ERR("Each key needs its own output file, %s is given more than once", paths[i]);
+                    goto params_fail;
+                }
+            }
+        }
+    }
+
+    if (params->fanout_key_count && (params->inplace_path || params->compress || params->decompress || params->index_path)) {
+        DEBUG_ERR("Multiple keys cannot be combined with -i, -z, -d or -r");
+        goto params_fail;
+    }
+
+    if (params->index_path && (params->inplace_path || params->compress || params->decompress)) {
+        DEBUG_ERR("-r cannot be combined with -i, -z or -d");
+        goto params_fail;
+    }
+
+    if (params->extract_record && (!params->index_path || !params->input_path)) {
+        DEBUG_ERR("-n requires -r <index_file> and an input file");
+        goto params_fail;
+    }
+
+    // Background jobs: lower I/O and CPU priority, and cap read and write bandwidth. Applied
+    //  here so the input file load below is already counted against -b
+    throttle_set_priority(params->priority);
+    throttle_set_rate(params->rate_limit);
+
+    if (params->input_path && !params->extract_record) {
+        // Read input file into heap
+        CRYPT_TRACE1(crypt, read_start, MAX_FILE_BUF_SIZE);
+        buf_size = read_file_into_memory(params->input_path, &buf);
+        CRYPT_TRACE1(crypt, read_done, buf_size);
+        if (!buf_size) {
+            DEBUG_ERR("Invalid input file: %s", params->input_path);
+            goto params_fail;
+        }
+        throttle_read(buf_size);
+
+        params->input_buffer = buf;
+        params->input_buffer_size = buf_size;
+
+        // -z adds a frame header per COMPRESS_BLOCK_SIZE block, at most two for a file that
+        //  read_file_into_memory() accepts. The output must still be accepted as -d input
+        if (params->compress && buf_size >= MAX_FILE_BUF_SIZE - (2 * COMPRESS_FRAME_HEADER_SIZE)) {
+            DEBUG_ERR("Input file is too large for -z, at most %d bytes (use stdin for larger input)",
+                MAX_FILE_BUF_SIZE - (2 * COMPRESS_FRAME_HEADER_SIZE) - 1);
+            goto params_fail;
+        }
+    }
+
     if (!params->key) {
         // Key was not specified in command line, ask through stdin
         DEBUG_INFO("Enter symmetric key: ");
@@ -341,20 +997,91 @@ params_fail:
             free(params->output_buffer_path);
         }
 
+        if (params->inplace_path) {
+            free(params->inplace_path);
+        }
+
+        if (params->log_path) {
+            free(params->log_path);
+        }
+
+        if (params->index_path) {
+            free(params->index_path);
+        }
+
+        if (params->input_path) {
+            free(params->input_path);
+        }
+
+        if (params->key) {
+            memset(params->key, 0x00, params->key_size);
+            free(params->key);
+        }
+
+        for (uint32_t i = 0; i < params->fanout_key_count; i++) {
+            memset(params->fanout_key[i], 0x00, params->fanout_key_size[i]);
+            free(params->fanout_key[i]);
+        }
+
+        for (uint32_t i = 0; i < params->fanout_output_count; i++) {
+            free(params->fanout_output_path[i]);
+        }
+
         free(params);        
     }
 
     return NULL;
 }
 
+static bool add_key(struct crypt_params *params, uint8_t *key, uint16_t key_size)
+{
+    if (!params->key) {
+        params->key = key;
+        params->key_size = key_size;
+        return true;
+    }
+
+    if (params->fanout_key_count >= CRYPT_MAX_FANOUT) {
+        DEBUG_ERR("Too many keys, at most %d", CRYPT_MAX_FANOUT + 1);
+        memset(key, 0x00, key_size);
+        free(key);
+        return false;
+    }
+
+    params->fanout_key[params->fanout_key_count] = key;
+    params->fanout_key_size[params->fanout_key_count] = key_size;
+    params->fanout_key_count++;
+    return true;
+}
+
 static void print_help(void)
 {
     DEBUG_INFO("Help: ");
-    DEBUG_INFO("crypt [-h] -k <key> | -f <key_file> [-o <output_file>] [<input_file>]");
+    DEBUG_INFO("crypt [-h] [-v | -q] [-l <log_file>] [-b <rate>] [-p <priority>] -k <key> | -f <key_file> [-z | -d] [-o <output_file>] [<input_file>]");
+    DEBUG_INFO("crypt [-h] [-v | -q] [-l <log_file>] [-b <rate>] [-p <priority>] -k <key> | -f <key_file> -i <target_file>");
+    DEBUG_INFO("crypt [-h] [-v | -q] [-l <log_file>] [-b <rate>] [-p <priority>] -k <key> | -f <key_file> -r <index_file> [-n <record>] [-o <output_file>] [<input_file>]");
     DEBUG_INFO("-h\t\t\t\tPrint this help");
-    DEBUG_INFO("-k <key>\t\t\tSupply a key via command line. -k and -f are mutually exclusive");
+    DEBUG_INFO("-k <key>\t\t\tSupply a key via command line");
     DEBUG_INFO("-f <key_path>\t\tSupply a key file via standard path");
+    DEBUG_INFO("\t\t\t\tRepeat -k/-f and -o to encrypt the input under each key, the Nth key is written to the Nth -o");
     DEBUG_INFO("-o <out_path>\t\tEncryption output sent to a file rather than stdout");
+    DEBUG_INFO("-z\t\t\t\tCompress the input before encrypting it");
+    DEBUG_INFO("-d\t\t\t\tDecompress the output after decrypting it, for input produced with -z");
+    DEBUG_INFO("-r <index_path>\t\tEncrypt newline-delimited records, writing (offset, length) per record to a new index");
+    DEBUG_INFO("\t\t\t\tThe index must not exist or be empty, and the output file is truncated");
+    DEBUG_INFO("-n <record>\t\t\tWith -r, decrypt only this record (from 0) of the encrypted input file");
+    DEBUG_INFO("-b <rate>\t\t\tLimit reads and writes to <rate> bytes per second each, K, M and G suffixes allowed");
+    DEBUG_INFO("-p <priority>\t\tnormal, low or idle. low and idle lower the I/O class and CPU nice value so");
+    DEBUG_INFO("\t\t\t\tinteractive work on the host is served first");
+    DEBUG_INFO("-v\t\t\t\tVerbose logging, including per-block I/O");
+    DEBUG_INFO("-q\t\t\t\tOnly log errors");
+    DEBUG_INFO("-l <log_path>\t\tAppend log messages to a file rather than stderr");
+    DEBUG_INFO("-i <target_path>\t\tEncrypt the target file in place. Progress is kept in <target_path>%s and an", INPLACE_JOURNAL_SUFFIX);
+    DEBUG_INFO("\t\t\t\tinterrupted run resumes when the same command is repeated");
+    DEBUG_INFO("\t\t\t\tOnce done the journal is kept and repeating the command does nothing, remove it");
+    DEBUG_INFO("\t\t\t\tto decrypt the file in place");
+    DEBUG_INFO("\t\t\t\tEach block is written to both the journal and the target, so with -b the target");
+    DEBUG_INFO("\t\t\t\tis written at roughly half the given rate");
     DEBUG_INFO("[<input_file>]\t\tOptional parameter that specifies the input buffer as a file, otherwise stdin will be used\n");
 
     DEBUG_INFO("Exiting cleanly.\n");
@@ -381,6 +1108,31 @@ static void free_cli_params(struct crypt_params *p)
         free(p->output_buffer_path);
     }
 
+    if (p->inplace_path) {
+        free(p->inplace_path);
+    }
+
+    if (p->log_path) {
+        free(p->log_path);
+    }
+
+    if (p->index_path) {
+        free(p->index_path);
+    }
+
+    if (p->input_path) {
+        free(p->input_path);
+    }
+
+    for (uint32_t i = 0; i < p->fanout_key_count; i++) {
+        memset(p->fanout_key[i], 0x00, p->fanout_key_size[i]);
+        free(p->fanout_key[i]);
+    }
+
+    for (uint32_t i = 0; i < p->fanout_output_count; i++) {
+        free(p->fanout_output_path[i]);
+    }
+
     free(p);
 }
 
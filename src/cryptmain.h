@@ -1,10 +1,23 @@
 #include <stdint.h>
+#include <stdbool.h>
 
 #define CRYPT_MAIN_VERSION          "1.0"
 
 // Stdin buffer size maximum
 #define CRYPT_STDIN_BUF_SIZE        0x10
 
+// Chunk size in record mode, records are encrypted and indexed a chunk at a time
+#define CRYPT_RECORD_BUF_SIZE       0x4000
+
+// Index entries produced per crypt_buffer_records() call
+#define CRYPT_RECORD_BATCH          0x400
+
+// Maximum number of additional key and output pairs for fan-out
+#define CRYPT_MAX_FANOUT            15
+
+// Chunk size read from stdin in fan-out mode
+#define CRYPT_FANOUT_BUF_SIZE       0x8000
+
 struct crypt_params {
     // Key
     uint8_t                         *key;
@@ -17,4 +30,40 @@ struct crypt_params {
     // Output buffer, pointer originates from args to main() and 
     //  must not be deallocated
     char                            *output_buffer_path;
+
+    // In-place target file, if set the input and output buffers are not used
+    char                            *inplace_path;
+
+    // Compress into frames before encrypting (-z), or decompress frames after decrypting (-d)
+    bool                            compress;
+    bool                            decompress;
+
+    // Input file path, the file is loaded into input_buffer unless a single record is extracted
+    char                            *input_path;
+
+    // Record index (-r), written when encrypting, read when extracting a record (-n)
+    char                            *index_path;
+    bool                            extract_record;
+    uint64_t                        record_number;
+
+    // Fan-out: every -k/-f and -o after the first pair. The input is encrypted under
+    //  fanout_key[i] and written to fanout_output_path[i], in addition to the first pair
+    uint8_t                         *fanout_key[CRYPT_MAX_FANOUT];
+    uint16_t                        fanout_key_size[CRYPT_MAX_FANOUT];
+    char                            *fanout_output_path[CRYPT_MAX_FANOUT];
+    uint32_t                        fanout_key_count;
+    uint32_t                        fanout_output_count;
+
+    // Number of -o given, `-o -` counts and is kept as a NULL path (stdout)
+    uint32_t                        output_count;
+
+    // Rate limit in bytes per second for reads and writes (-b), 0 for none
+    uint64_t                        rate_limit;
+
+    // I/O and CPU priority (-p), THROTTLE_PRIORITY_*
+    int32_t                         priority;
+
+    // Logger level (-v, -q) and optional log file (-l), stderr otherwise
+    int32_t                         log_level;
+    char                            *log_path;
 };
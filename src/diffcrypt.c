@@ -0,0 +1,651 @@
+// clock_gettime()
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "libcryptprov.h"
+#include "diffcrypt.h"
+#include "util.h"
+
+// Reference implementation, the original crypt_buffer() loop with its own key copy
+struct ref_context {
+    uint8_t                         key[CRYPT_MAX_KEY_LEN];
+    uint8_t                         key_size;
+    uint8_t                         key_state;
+};
+
+struct bench_thread {
+    const struct crypt_keystream    *ks;
+    uint8_t                         *output;
+    const uint8_t                   *input;
+    uint64_t                        offset;
+    uint32_t                        len;
+};
+
+static uint64_t rng_state;
+
+// xorshift64*, reproducible from the seed that is printed at startup
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+// Uniform in [lo, hi]
+static uint32_t rng_range(uint32_t lo, uint32_t hi)
+{
+    return lo + (uint32_t)(rng_next() % ((uint64_t)hi - lo + 1));
+}
+
+static void rng_fill(uint8_t *buf, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)rng_next();
+    }
+}
+
+static void ref_init(struct ref_context *ref, const uint8_t *key, uint8_t key_size)
+{
+    memset(ref, 0x00, sizeof(*ref));
+    memcpy(ref->key, key, key_size);
+    ref->key_size = key_size;
+}
+
+static void ref_buffer(struct ref_context *ref, uint8_t *output, const uint8_t *input, uint32_t inputLen)
+{
+    uint8_t i = ref->key_state;
+
+    for (uint32_t pos = 0; pos < inputLen; pos++) {
+        ref->key[i] = (ref->key[i] + i) % 256;
+        output[pos] = input[pos] ^ ref->key[i];
+        i = (i + 1) % ref->key_size;
+    }
+
+    ref->key_state = i;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Report the first difference
+static bool check(const char *path, uint8_t key_size, const uint8_t *expected, const uint8_t *actual, uint32_t len, uint64_t base)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        if (expected[i] != actual[i]) {
+            DEBUG_ERR("%s: key_size %d, mismatch at stream offset %llu: expected 0x%02x, got 0x%02x",
+                path, key_size, (unsigned long long)(base + i), expected[i], actual[i]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// crypt_buffer() with random split points, output and key_state after every call
+static bool diff_split(const uint8_t *key, uint8_t key_size, const uint8_t *input, const uint8_t *expected, uint32_t len)
+{
+    struct crypt_context *ctx = NULL;
+    struct ref_context ref;
+    uint8_t scratch[1];
+    bool res = false;
+
+    uint8_t *out = (uint8_t *)malloc(len);
+    if (!out || crypt_alloc_context(&ctx, key, key_size) != CRYPT_ERROR_OK) {
+        goto split_cleanup;
+    }
+    ref_init(&ref, key, key_size);
+
+    for (uint32_t pos = 0; pos < len; ) {
+        uint32_t max = len - pos < CRYPT_MAX_BUFFER_SIZE ? len - pos : CRYPT_MAX_BUFFER_SIZE;
+
+        // Mostly short calls, occasionally as large as allowed
+        uint32_t chunk = (rng_next() % 4) ? rng_range(1, max < 300 ? max : 300) : rng_range(1, max);
+
+        if (crypt_buffer(ctx, out + pos, input + pos, chunk) != chunk) {
+            DEBUG_ERR("crypt_buffer: key_size %d, call failed (len: %d)", key_size, chunk);
+            goto split_cleanup;
+        }
+
+        for (uint32_t i = 0; i < chunk; i++) {
+            ref_buffer(&ref, scratch, input + pos + i, 1);
+        }
+
+        pos += chunk;
+
+        if (ctx->key_state != ref.key_state) {
+            DEBUG_ERR("crypt_buffer: key_size %d, key_state %d after %d bytes, expected %d",
+                key_size, ctx->key_state, pos, ref.key_state);
+            goto split_cleanup;
+        }
+    }
+
+    res = check("crypt_buffer", key_size, expected, out, len, 0);
+
+split_cleanup:
+    crypt_free_context(ctx);
+    free(out);
+    return res;
+}
+
+// crypt_advance_context() to a random offset, then crypt_buffer()
+static bool diff_advance(const uint8_t *key, uint8_t key_size, const uint8_t *input, const uint8_t *expected, uint32_t len)
+{
+    struct crypt_context *ctx = NULL;
+    bool res = false;
+
+    const uint32_t offset = rng_range(0, len - 1);
+    uint32_t chunk = len - offset;
+    if (chunk > CRYPT_MAX_BUFFER_SIZE) {
+        chunk = CRYPT_MAX_BUFFER_SIZE;
+    }
+
+    uint8_t *out = (uint8_t *)malloc(chunk);
+    if (!out || crypt_alloc_context(&ctx, key, key_size) != CRYPT_ERROR_OK) {
+        goto advance_cleanup;
+    }
+
+    // Some of the skip in one call, the rest in a second one
+    const uint32_t first = rng_range(0, offset);
+    if (crypt_advance_context(ctx, first) != CRYPT_ERROR_OK ||
+            crypt_advance_context(ctx, offset - first) != CRYPT_ERROR_OK) {
+        DEBUG_ERR("crypt_advance_context: key_size %d, call failed", key_size);
+        goto advance_cleanup;
+    }
+
+    if (ctx->key_state != offset % key_size) {
+        DEBUG_ERR("crypt_advance_context: key_size %d, key_state %d at offset %d", key_size, ctx->key_state, offset);
+        goto advance_cleanup;
+    }
+
+    crypt_buffer(ctx, out, input + offset, chunk);
+    res = check("crypt_advance_context", key_size, expected + offset, out, chunk, offset);
+
+advance_cleanup:
+    crypt_free_context(ctx);
+    free(out);
+    return res;
+}
+
+// crypt_buffer_at() on random ranges, in random order
+static bool diff_at(const uint8_t *key, uint8_t key_size, const uint8_t *input, const uint8_t *expected, uint32_t len)
+{
+    struct crypt_keystream *ks = NULL;
+    bool res = false;
+
+    uint8_t *out = (uint8_t *)malloc(len);
+    if (!out || crypt_alloc_keystream(&ks, key, key_size) != CRYPT_ERROR_OK) {
+        goto at_cleanup;
+    }
+
+    for (uint32_t n = 0; n < 16; n++) {
+        const uint32_t offset = rng_range(0, len - 1);
+        uint32_t chunk = rng_range(1, len - offset);
+        if (chunk > CRYPT_MAX_BUFFER_SIZE) {
+            chunk = CRYPT_MAX_BUFFER_SIZE;
+        }
+
+        if (crypt_buffer_at(ks, out, input + offset, chunk, offset) != chunk) {
+            DEBUG_ERR("crypt_buffer_at: key_size %d, call failed", key_size);
+            goto at_cleanup;
+        }
+
+        if (!check("crypt_buffer_at", key_size, expected + offset, out, chunk, offset)) {
+            goto at_cleanup;
+        }
+    }
+
+    res = true;
+
+at_cleanup:
+    crypt_free_keystream(ks);
+    free(out);
+    return res;
+}
+
+static void *at_thread(void *arg)
+{
+    struct bench_thread *t = (struct bench_thread *)arg;
+
+    for (uint32_t pos = 0; pos < t->len; ) {
+        uint32_t chunk = t->len - pos;
+        if (chunk > CRYPT_MAX_BUFFER_SIZE) {
+            chunk = CRYPT_MAX_BUFFER_SIZE;
+        }
+
+        crypt_buffer_at(t->ks, t->output + pos, t->input + pos, chunk, t->offset + pos);
+        pos += chunk;
+    }
+
+    return NULL;
+}
+
+// Encrypt disjoint regions of one stream from threads sharing a keystream handle
+static bool run_threads(const struct crypt_keystream *ks, uint8_t *out, const uint8_t *input, uint32_t len, uint32_t threads)
+{
+    pthread_t tid[DIFF_MAX_THREADS];
+    struct bench_thread t[DIFF_MAX_THREADS];
+    uint32_t started = 0;
+
+    for (uint32_t i = 0; i < threads; i++) {
+        const uint32_t start = (uint32_t)(((uint64_t)len * i) / threads);
+        const uint32_t end = (uint32_t)(((uint64_t)len * (i + 1)) / threads);
+
+        t[i].ks = ks;
+        t[i].output = out + start;
+        t[i].input = input + start;
+        t[i].offset = start;
+        t[i].len = end - start;
+
+        if (pthread_create(&tid[i], NULL, at_thread, &t[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+
+    for (uint32_t i = 0; i < started; i++) {
+        pthread_join(tid[i], NULL);
+    }
+
+    return started == threads;
+}
+
+static bool diff_threads(const uint8_t *key, uint8_t key_size, const uint8_t *input, const uint8_t *expected, uint32_t len)
+{
+    struct crypt_keystream *ks = NULL;
+    bool res = false;
+
+    uint8_t *out = (uint8_t *)malloc(len);
+    if (!out || crypt_alloc_keystream(&ks, key, key_size) != CRYPT_ERROR_OK) {
+        goto threads_cleanup;
+    }
+
+    for (uint32_t threads = 1; threads <= DIFF_MAX_THREADS; threads *= 2) {
+        memset(out, 0x00, len);
+
+        if (!run_threads(ks, out, input, len, threads)) {
+            DEBUG_ERR("crypt_buffer_at: failed to start %d threads", threads);
+            goto threads_cleanup;
+        }
+
+        if (!check("crypt_buffer_at (threads)", key_size, expected, out, len, 0)) {
+            DEBUG_ERR("crypt_buffer_at: failed with %d threads", threads);
+            goto threads_cleanup;
+        }
+    }
+
+    res = true;
+
+threads_cleanup:
+    crypt_free_keystream(ks);
+    free(out);
+    return res;
+}
+
+// crypt_buffer_multi() with the key under test plus random keys, one of them repeated
+static bool diff_multi(const uint8_t *key, uint8_t key_size, const uint8_t *input, const uint8_t *expected, uint32_t len)
+{
+    struct crypt_context *ctxs[DIFF_MULTI_KEYS] = { NULL };
+    struct ref_context refs[DIFF_MULTI_KEYS];
+    uint8_t *outs[DIFF_MULTI_KEYS] = { NULL };
+    uint8_t keys[DIFF_MULTI_KEYS][CRYPT_MAX_KEY_LEN];
+    uint8_t sizes[DIFF_MULTI_KEYS];
+    bool res = false;
+
+    uint8_t *ref_out = (uint8_t *)malloc(CRYPT_MAX_BUFFER_SIZE);
+    if (!ref_out) {
+        return false;
+    }
+
+    for (uint32_t k = 0; k < DIFF_MULTI_KEYS; k++) {
+        if (k == 0 || k == DIFF_MULTI_KEYS - 1) {
+            memcpy(keys[k], key, key_size);
+            sizes[k] = key_size;
+        } else {
+            sizes[k] = (uint8_t)rng_range(1, CRYPT_MAX_KEY_LEN - 1);
+            rng_fill(keys[k], sizes[k]);
+        }
+
+        outs[k] = (uint8_t *)malloc(CRYPT_MAX_BUFFER_SIZE);
+        if (!outs[k] || crypt_alloc_context(&ctxs[k], keys[k], sizes[k]) != CRYPT_ERROR_OK) {
+            goto multi_cleanup;
+        }
+        ref_init(&refs[k], keys[k], sizes[k]);
+    }
+
+    // In place is rejected, outputs[0] == input would feed ciphertext into the other keys
+    uint8_t *saved = outs[0];
+    memcpy(ref_out, input, len < CRYPT_MAX_BUFFER_SIZE ? len : CRYPT_MAX_BUFFER_SIZE);
+    outs[0] = ref_out;
+    const uint32_t aliased = crypt_buffer_multi(ctxs, outs, DIFF_MULTI_KEYS, ref_out, len < CRYPT_MAX_BUFFER_SIZE ? len : CRYPT_MAX_BUFFER_SIZE);
+    outs[0] = saved;
+    if (aliased != 0 || ctxs[0]->keystream_pos != 0) {
+        DEBUG_ERR("crypt_buffer_multi: key_size %d, output aliasing the input was not rejected", key_size);
+        goto multi_cleanup;
+    }
+
+    // The last context starts out of step with the first, despite sharing the key
+    crypt_advance_context(ctxs[DIFF_MULTI_KEYS - 1], 1);
+    ref_buffer(&refs[DIFF_MULTI_KEYS - 1], ref_out, input, 1);
+
+    for (uint32_t pos = 0; pos < len; ) {
+        const uint32_t max = len - pos < CRYPT_MAX_BUFFER_SIZE ? len - pos : CRYPT_MAX_BUFFER_SIZE;
+        const uint32_t chunk = rng_range(1, max);
+
+        if (crypt_buffer_multi(ctxs, outs, DIFF_MULTI_KEYS, input + pos, chunk) != chunk) {
+            DEBUG_ERR("crypt_buffer_multi: key_size %d, call failed", key_size);
+            goto multi_cleanup;
+        }
+
+        for (uint32_t k = 0; k < DIFF_MULTI_KEYS; k++) {
+            ref_buffer(&refs[k], ref_out, input + pos, chunk);
+            if (!check("crypt_buffer_multi", sizes[k], ref_out, outs[k], chunk, pos) ||
+                    ctxs[k]->key_state != refs[k].key_state) {
+                DEBUG_ERR("crypt_buffer_multi: key %d differs", k);
+                goto multi_cleanup;
+            }
+        }
+
+        // The first key is also checked against the shared expected stream
+        if (!check("crypt_buffer_multi", key_size, expected + pos, outs[0], chunk, pos)) {
+            goto multi_cleanup;
+        }
+
+        pos += chunk;
+    }
+
+    res = true;
+
+multi_cleanup:
+    for (uint32_t k = 0; k < DIFF_MULTI_KEYS; k++) {
+        crypt_free_context(ctxs[k]);
+        free(outs[k]);
+    }
+    free(ref_out);
+    return res;
+}
+
+// crypt_buffer_records() on input with random newlines, output and reported records
+static bool diff_records(const uint8_t *key, uint8_t key_size, uint8_t *input, uint32_t len)
+{
+    struct crypt_context *ctx = NULL;
+    struct crypt_record_state state = { 0 };
+    struct crypt_record records[DIFF_RECORD_BATCH];
+    struct ref_context ref;
+    bool res = false;
+
+    // About one newline every 40 bytes
+    for (uint32_t i = 0; i < len; i++) {
+        if (input[i] == '\n' || rng_next() % 40 == 0) {
+            input[i] = '\n';
+        }
+    }
+
+    uint8_t *expected = (uint8_t *)malloc(len);
+    uint8_t *out = (uint8_t *)malloc(len);
+    if (!expected || !out || crypt_alloc_context(&ctx, key, key_size) != CRYPT_ERROR_OK) {
+        goto records_cleanup;
+    }
+
+    ref_init(&ref, key, key_size);
+    ref_buffer(&ref, expected, input, len);
+
+    uint64_t next_record = 0, record_start = 0;
+
+    for (uint32_t pos = 0; pos < len; ) {
+        const uint32_t max = len - pos < CRYPT_MAX_BUFFER_SIZE ? len - pos : CRYPT_MAX_BUFFER_SIZE;
+        const uint32_t chunk = rng_range(1, max);
+        uint32_t count = 0;
+
+        const uint32_t consumed = crypt_buffer_records(ctx, &state, out + pos, input + pos, chunk, records, DIFF_RECORD_BATCH, &count);
+        if (!consumed || consumed > chunk) {
+            DEBUG_ERR("crypt_buffer_records: key_size %d, call failed", key_size);
+            goto records_cleanup;
+        }
+
+        for (uint32_t r = 0; r < count; r++) {
+            const uint64_t end = records[r].offset + records[r].length;
+
+            if (records[r].record != next_record || records[r].offset != record_start ||
+                    records[r].length == 0 || input[end - 1] != '\n' ||
+                    memchr(input + records[r].offset, '\n', (size_t)records[r].length - 1)) {
+                DEBUG_ERR("crypt_buffer_records: key_size %d, record %llu is wrong", key_size,
+                    (unsigned long long)next_record);
+                goto records_cleanup;
+            }
+
+            next_record++;
+            record_start = end;
+        }
+
+        pos += consumed;
+    }
+
+    struct crypt_record last;
+    if (crypt_record_finish(&state, &last)) {
+        if (last.offset != record_start || last.offset + last.length != len) {
+            DEBUG_ERR("crypt_buffer_records: key_size %d, final record is wrong", key_size);
+            goto records_cleanup;
+        }
+    } else if (record_start != len) {
+        DEBUG_ERR("crypt_buffer_records: key_size %d, final record missing", key_size);
+        goto records_cleanup;
+    }
+
+    res = check("crypt_buffer_records", key_size, expected, out, len, 0);
+
+records_cleanup:
+    crypt_free_context(ctx);
+    free(expected);
+    free(out);
+    return res;
+}
+
+static bool diff_key_size(uint8_t key_size, uint32_t rounds)
+{
+    uint8_t key[CRYPT_MAX_KEY_LEN];
+    bool res = false;
+
+    uint8_t *input = (uint8_t *)malloc(DIFF_MAX_STREAM_LEN);
+    uint8_t *expected = (uint8_t *)malloc(DIFF_MAX_STREAM_LEN);
+    if (!input || !expected) {
+        DEBUG_ERR("diff_key_size: out of memory");
+        goto key_size_cleanup;
+    }
+
+    for (uint32_t round = 0; round < rounds; round++) {
+        rng_fill(key, key_size);
+
+        // Lengths around one and two keystream periods, and anywhere up to the maximum
+        const uint32_t period = 256 * (uint32_t)key_size;
+        uint32_t len;
+        switch (round % 4) {
+        case 0:
+            len = period + rng_range(0, 2) - 1;
+            break;
+        case 1:
+            len = 2 * period + rng_range(0, 2) - 1;
+            break;
+        case 2:
+            len = rng_range(1, 64);
+            break;
+        default:
+            len = rng_range(1, DIFF_MAX_STREAM_LEN);
+            break;
+        }
+
+        rng_fill(input, len);
+
+        struct ref_context ref;
+        ref_init(&ref, key, key_size);
+        ref_buffer(&ref, expected, input, len);
+
+        if (!diff_split(key, key_size, input, expected, len) ||
+                !diff_advance(key, key_size, input, expected, len) ||
+                !diff_at(key, key_size, input, expected, len) ||
+                !diff_threads(key, key_size, input, expected, len) ||
+                !diff_multi(key, key_size, input, expected, len) ||
+                !diff_records(key, key_size, input, len)) {
+            DEBUG_ERR("key_size %d failed in round %d (len: %d)", key_size, round, len);
+            goto key_size_cleanup;
+        }
+    }
+
+    res = true;
+
+key_size_cleanup:
+    free(input);
+    free(expected);
+    return res;
+}
+
+static void bench_report(const char *path, double ref_sec, double sec)
+{
+    DEBUG_INFO("  %-28s %8.1f MB/s  %6.2fx", path, (double)DIFF_BENCH_LEN / sec / 1e6, ref_sec / sec);
+}
+
+// Throughput of each path against the reference loop
+static void bench_key_size(uint8_t key_size)
+{
+    uint8_t key[CRYPT_MAX_KEY_LEN];
+    struct crypt_context *ctx = NULL;
+    struct crypt_context *ctxs[DIFF_MULTI_KEYS] = { NULL };
+    struct crypt_keystream *ks = NULL;
+    uint8_t *outs[DIFF_MULTI_KEYS] = { NULL };
+    struct ref_context ref;
+
+    uint8_t *input = (uint8_t *)malloc(DIFF_BENCH_LEN);
+    uint8_t *out = (uint8_t *)malloc(DIFF_BENCH_LEN);
+    if (!input || !out) {
+        goto bench_cleanup;
+    }
+
+    rng_fill(key, key_size);
+    rng_fill(input, DIFF_BENCH_LEN);
+
+    // Fixed size calls, as the CLI makes them
+    const uint32_t chunk = 0x8000;
+
+    ref_init(&ref, key, key_size);
+    double start = now_sec();
+    for (uint32_t pos = 0; pos < DIFF_BENCH_LEN; pos += chunk) {
+        ref_buffer(&ref, out + pos, input + pos, chunk);
+    }
+    const double ref_sec = now_sec() - start;
+
+    DEBUG_INFO("key_size %d, %d MB per path, %d byte calls:", key_size, DIFF_BENCH_LEN >> 20, chunk);
+    bench_report("reference", ref_sec, ref_sec);
+
+    if (crypt_alloc_context(&ctx, key, key_size) != CRYPT_ERROR_OK ||
+            crypt_alloc_keystream(&ks, key, key_size) != CRYPT_ERROR_OK) {
+        goto bench_cleanup;
+    }
+
+    start = now_sec();
+    for (uint32_t pos = 0; pos < DIFF_BENCH_LEN; pos += chunk) {
+        crypt_buffer(ctx, out + pos, input + pos, chunk);
+    }
+    bench_report("crypt_buffer", ref_sec, now_sec() - start);
+
+    start = now_sec();
+    for (uint32_t pos = 0; pos < DIFF_BENCH_LEN; pos += chunk) {
+        crypt_buffer_at(ks, out + pos, input + pos, chunk, pos);
+    }
+    bench_report("crypt_buffer_at", ref_sec, now_sec() - start);
+
+    for (uint32_t threads = 2; threads <= DIFF_MAX_THREADS; threads *= 2) {
+        char name[64];
+        snprintf(name, sizeof(name), "crypt_buffer_at (%d threads)", threads);
+
+        start = now_sec();
+        run_threads(ks, out, input, DIFF_BENCH_LEN, threads);
+        bench_report(name, ref_sec, now_sec() - start);
+    }
+
+    // Per key, against running crypt_buffer() once per key
+    for (uint32_t k = 0; k < DIFF_MULTI_KEYS; k++) {
+        outs[k] = (uint8_t *)malloc(chunk);
+        if (!outs[k] || crypt_alloc_context(&ctxs[k], key, key_size) != CRYPT_ERROR_OK) {
+            goto bench_cleanup;
+        }
+    }
+
+    start = now_sec();
+    for (uint32_t pos = 0; pos < DIFF_BENCH_LEN; pos += chunk) {
+        crypt_buffer_multi(ctxs, outs, DIFF_MULTI_KEYS, input + pos, chunk);
+    }
+    bench_report("crypt_buffer_multi (per key)", ref_sec, (now_sec() - start) / DIFF_MULTI_KEYS);
+
+bench_cleanup:
+    for (uint32_t k = 0; k < DIFF_MULTI_KEYS; k++) {
+        crypt_free_context(ctxs[k]);
+        free(outs[k]);
+    }
+    crypt_free_context(ctx);
+    crypt_free_keystream(ks);
+    free(input);
+    free(out);
+}
+
+static void print_help(void)
+{
+    DEBUG_INFO("diffcrypt [-h] [-s <seed>] [-r <rounds>] [-n]");
+    DEBUG_INFO("-s <seed>\t\tRandom seed, to reproduce a failure");
+    DEBUG_INFO("-r <rounds>\t\tRounds per key size (default: %d)", DIFF_DEFAULT_ROUNDS);
+    DEBUG_INFO("-n\t\t\tSkip the benchmark");
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t seed = (uint64_t)time(NULL);
+    uint32_t rounds = DIFF_DEFAULT_ROUNDS;
+    bool bench = true;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp("-s", argv[i]) && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp("-r", argv[i]) && i + 1 < argc) {
+            rounds = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp("-n", argv[i])) {
+            bench = false;
+        } else {
+            print_help();
+            return -1;
+        }
+    }
+
+    // xorshift must not start at 0
+    rng_state = seed ? seed : 1;
+
+    DEBUG_INFO("Starting diffcrypt, differential test against the reference crypt_buffer() loop");
+    DEBUG_INFO("Seed: %llu, rounds per key size: %d", (unsigned long long)seed, rounds);
+
+    for (uint32_t key_size = 1; key_size < CRYPT_MAX_KEY_LEN; key_size++) {
+        if (!diff_key_size((uint8_t)key_size, rounds)) {
+            DEBUG_ERR("diffcrypt failed, reproduce with: diffcrypt -s %llu -r %d", (unsigned long long)seed, rounds);
+            return -1;
+        }
+    }
+
+    DEBUG_INFO("All paths match the reference for key sizes 1 to %d", CRYPT_MAX_KEY_LEN - 1);
+
+    if (bench) {
+        const uint8_t bench_sizes[] = { 1, 6, 64, 254 };
+        for (uint32_t i = 0; i < sizeof(bench_sizes) / sizeof(uint8_t); i++) {
+            bench_key_size(bench_sizes[i]);
+        }
+    }
+
+    return 0;
+}
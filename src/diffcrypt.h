@@ -0,0 +1,22 @@
+#include <stdint.h>
+
+// Differential test: every optimized libcryptprov path against the original scalar loop
+
+// Rounds per key size, each with a new random key, length and split points
+#define DIFF_DEFAULT_ROUNDS                         4
+
+// Upper bound of the random stream length per round, covers several keystream periods
+//  (256 * key_size) for every key size
+#define DIFF_MAX_STREAM_LEN                         (uint32_t)(3 * 256 * 254 + 1024)
+
+// Thread counts tried for concurrent crypt_buffer_at() on one keystream handle
+#define DIFF_MAX_THREADS                            8
+
+// Contexts per crypt_buffer_multi() call
+#define DIFF_MULTI_KEYS                             4
+
+// Records per crypt_buffer_records() call, small to exercise partial consumption
+#define DIFF_RECORD_BATCH                           7
+
+// Bytes per path in the benchmark
+#define DIFF_BENCH_LEN                              (uint32_t)(32 << 20)
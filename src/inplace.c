@@ -0,0 +1,433 @@
+// pread(), pwrite(), fdatasync() and posix_fadvise()
+#define _XOPEN_SOURCE 600
+#define _FILE_OFFSET_BITS 64
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "libcryptprov.h"
+#include "inplace.h"
+#include "util.h"
+#include "throttle.h"
+
+// Journal layout:
+//  [slot 0 header][slot 1 header][redo area 0][redo area 1]
+//
+// Each block goes through:
+//  1) Encrypted block is written to the redo area of the next header slot and synced
+//  2) Header (offset, pending length, redo hash) is written to that slot and synced
+//  3) Encrypted block is written to the target file and synced
+//
+// The header with the highest valid sequence wins. Its pending block is rewritten from the
+//  redo area on resume, which is idempotent, so a run can be killed at any point. Slots and
+//  redo areas alternate, so writing a new block never touches the one the current header
+//  points at.
+//
+// After the last block a final header with the completed flag set is committed and the journal
+//  is kept as a marker, so repeating the command does not decrypt the file again.
+#define JOURNAL_MAGIC                               0x4e4a5243 // "CRJN"
+#define JOURNAL_VERSION                             2
+#define JOURNAL_SLOT_SIZE                           512
+#define JOURNAL_REDO_OFFSET(slot)                   (off_t)((2 * JOURNAL_SLOT_SIZE) + ((slot) * (off_t)INPLACE_BLOCK_SIZE))
+
+// The header is hashed and written as raw bytes, so every byte is a named field: there is no
+//  compiler padding whose contents could differ between the hashed and the copied struct
+struct journal_header {
+    uint32_t                        magic;
+    uint32_t                        version;
+    uint64_t                        sequence;
+
+    // Target file and key this journal belongs to. key_hash is FNV-1a of key_salt followed
+    //  by the key, the per-journal random salt keeps it from being precomputed for a key
+    uint64_t                        file_size;
+    uint64_t                        key_salt;
+    uint64_t                        key_hash;
+    uint16_t                        key_size;
+
+    // Context state at offset, used to validate the resume
+    uint8_t                         key_state;
+
+    // Set once offset == file_size, the target is fully processed
+    uint8_t                         completed;
+    uint32_t                        reserved0; // Zero
+
+    // Bytes of the target file that are committed
+    uint64_t                        offset;
+
+    // Encrypted block at offset, stored in the redo area, not yet known to be in the target
+    uint32_t                        pending_len;
+    uint32_t                        reserved1; // Zero
+    uint64_t                        pending_hash;
+
+    // FNV-1a of the header with this field zeroed
+    uint64_t                        header_hash;
+};
+
+// Fails to compile if the compiler inserts padding into journal_header
+typedef char journal_header_unpadded[(sizeof(struct journal_header) == 80) ? 1 : -1];
+
+struct journal {
+    int                             fd;
+    char                            *path;
+    struct journal_header           hdr;
+};
+
+// 64-bit FNV-1a
+static uint64_t fnv1a(const void *buf, size_t len, uint64_t hash)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+#define FNV1A_BASIS                                 0xcbf29ce484222325ULL
+
+static uint64_t header_hash(const struct journal_header *hdr)
+{
+    struct journal_header tmp = *hdr;
+    tmp.header_hash = 0;
+    return fnv1a(&tmp, sizeof(tmp), FNV1A_BASIS);
+}
+
+static uint64_t key_hash(uint64_t salt, const uint8_t *key, uint16_t key_size)
+{
+    return fnv1a(key, key_size, fnv1a(&salt, sizeof(salt), FNV1A_BASIS));
+}
+
+// Random salt for a new journal, falls back to time and pid if /dev/urandom is unavailable
+static uint64_t journal_salt(void)
+{
+    uint64_t salt = 0;
+
+    const int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        const ssize_t res = read(fd, &salt, sizeof(salt));
+        close(fd);
+        if (res == (ssize_t)sizeof(salt)) {
+            return salt;
+        }
+    }
+
+    salt = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    return fnv1a(&salt, sizeof(salt), FNV1A_BASIS);
+}
+
+// Loop until all bytes are transferred, pread()/pwrite() may return short counts
+static bool pread_full(int fd, void *buf, size_t len, off_t off)
+{
+    uint8_t *p = (uint8_t *)buf;
+
+    while (len > 0) {
+        const ssize_t res = pread(fd, p, len, off);
+        if (res <= 0) {
+            return false;
+        }
+        p += res;
+        off += res;
+        len -= res;
+        throttle_read(res);
+    }
+
+    return true;
+}
+
+static bool pwrite_full(int fd, const void *buf, size_t len, off_t off)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    while (len > 0) {
+        const ssize_t res = pwrite(fd, p, len, off);
+        if (res <= 0) {
+            return false;
+        }
+        p += res;
+        off += res;
+        len -= res;
+        throttle_write(res);
+    }
+
+    return true;
+}
+
+// Write the next header generation into the alternate slot
+static bool journal_commit(struct journal *j)
+{
+    j->hdr.sequence++;
+    j->hdr.header_hash = header_hash(&j->hdr);
+
+    uint8_t slot[JOURNAL_SLOT_SIZE] = { 0 };
+    memcpy(slot, &j->hdr, sizeof(j->hdr));
+
+    const off_t off = (off_t)(j->hdr.sequence % 2) * JOURNAL_SLOT_SIZE;
+    if (!pwrite_full(j->fd, slot, sizeof(slot), off) || fsync(j->fd) != 0) {
+        DEBUG_ERR("journal: failed to commit header to %s", j->path);
+        return false;
+    }
+
+    return true;
+}
+
+// Load the most recent valid header, returns false if there is none
+static bool journal_load(struct journal *j)
+{
+    bool found = false;
+
+    for (uint32_t slot = 0; slot < 2; slot++) {
+        struct journal_header hdr;
+        if (!pread_full(j->fd, &hdr, sizeof(hdr), (off_t)slot * JOURNAL_SLOT_SIZE)) {
+            continue;
+        }
+
+        if (hdr.magic != JOURNAL_MAGIC || hdr.version != JOURNAL_VERSION ||
+                hdr.header_hash != header_hash(&hdr) || hdr.sequence % 2 != slot) {
+            continue;
+        }
+
+        if (!found || hdr.sequence > j->hdr.sequence) {
+            j->hdr = hdr;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+// Stage an encrypted block in the redo area and point a new header at it
+static bool journal_stage(struct journal *j, const uint8_t *buf, uint32_t len)
+{
+    const uint32_t next_slot = (uint32_t)((j->hdr.sequence + 1) % 2);
+
+    if (!pwrite_full(j->fd, buf, len, JOURNAL_REDO_OFFSET(next_slot)) || fdatasync(j->fd) != 0) {
+        DEBUG_ERR("journal: failed to write redo block to %s", j->path);
+        return false;
+    }
+
+    j->hdr.pending_len = len;
+    j->hdr.pending_hash = fnv1a(buf, len, FNV1A_BASIS);
+
+    return journal_commit(j);
+}
+
+// Encrypt a block with crypt_buffer(), which takes at most CRYPT_MAX_BUFFER_SIZE per call
+static bool crypt_block(struct crypt_context *ctx, uint8_t *buf, uint32_t len)
+{
+    for (uint32_t pos = 0; pos < len; ) {
+        uint32_t chunk = len - pos;
+        if (chunk > CRYPT_MAX_BUFFER_SIZE) {
+            chunk = CRYPT_MAX_BUFFER_SIZE;
+        }
+
+        if (crypt_buffer(ctx, buf + pos, buf + pos, chunk) != chunk) {
+            return false;
+        }
+        pos += chunk;
+    }
+
+    return true;
+}
+
+// Replay a pending block from the redo area into the target file
+static bool journal_replay(struct journal *j, int fd, uint8_t *buf)
+{
+    if (j->hdr.pending_len == 0) {
+        return true;
+    }
+
+    if (j->hdr.pending_len > INPLACE_BLOCK_SIZE || j->hdr.offset + j->hdr.pending_len > j->hdr.file_size) {
+        DEBUG_ERR("journal: invalid pending block in %s", j->path);
+        return false;
+    }
+
+    const uint32_t slot = (uint32_t)(j->hdr.sequence % 2);
+    if (!pread_full(j->fd, buf, j->hdr.pending_len, JOURNAL_REDO_OFFSET(slot)) ||
+            fnv1a(buf, j->hdr.pending_len, FNV1A_BASIS) != j->hdr.pending_hash) {
+        DEBUG_ERR("journal: redo block in %s is corrupt", j->path);
+        return false;
+    }
+
+    if (!pwrite_full(fd, buf, j->hdr.pending_len, (off_t)j->hdr.offset) || fdatasync(fd) != 0) {
+        DEBUG_ERR("journal: failed to replay block at offset %llu", (unsigned long long)j->hdr.offset);
+        return false;
+    }
+
+    DEBUG_INFO("journal: replayed %u bytes at offset %llu", j->hdr.pending_len, (unsigned long long)j->hdr.offset);
+
+    j->hdr.offset += j->hdr.pending_len;
+    j->hdr.key_state = (uint8_t)(j->hdr.offset % j->hdr.key_size);
+    j->hdr.pending_len = 0;
+    j->hdr.pending_hash = 0;
+
+    return journal_commit(j);
+}
+
+int32_t crypt_file_inplace(struct crypt_context *ctx, const char *path, const uint8_t *key, uint16_t key_size)
+{
+    if (!ctx || !path || !key || key_size == 0) {
+        return -1;
+    }
+
+    int32_t ret = -1;
+    uint8_t *buf = NULL;
+    struct journal j = { .fd = -1 };
+
+    const int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        DEBUG_ERR("crypt_file_inplace: failed to open %s", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        DEBUG_ERR("crypt_file_inplace: %s is not a regular file", path);
+        goto inplace_cleanup;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    const size_t path_len = strlen(path);
+    j.path = (char *)calloc(path_len + sizeof(INPLACE_JOURNAL_SUFFIX), sizeof(char));
+    buf = (uint8_t *)malloc(INPLACE_BLOCK_SIZE);
+    if (!j.path || !buf) {
+        DEBUG_ERR("crypt_file_inplace: out of memory");
+        goto inplace_cleanup;
+    }
+    memcpy(j.path, path, path_len);
+    memcpy(j.path + path_len, INPLACE_JOURNAL_SUFFIX, sizeof(INPLACE_JOURNAL_SUFFIX));
+
+    j.fd = open(j.path, O_RDWR | O_CREAT, 0600);
+    if (j.fd < 0) {
+        DEBUG_ERR("crypt_file_inplace: failed to open journal %s", j.path);
+        goto inplace_cleanup;
+    }
+
+    struct stat journal_st;
+    if (fstat(j.fd, &journal_st) != 0) {
+        DEBUG_ERR("crypt_file_inplace: failed to stat journal %s", j.path);
+        goto inplace_cleanup;
+    }
+
+    if (journal_load(&j)) {
+        // Resume, the journal must describe this file and key
+        if (j.hdr.file_size != (uint64_t)st.st_size || j.hdr.key_hash != key_hash(j.hdr.key_salt, key, key_size) ||
+                j.hdr.key_size != key_size || j.hdr.offset > j.hdr.file_size) {
+            DEBUG_ERR("crypt_file_inplace: journal %s does not match file or key, refusing to resume", j.path);
+            goto inplace_cleanup;
+        }
+
+        if (j.hdr.completed) {
+            DEBUG_INFO("crypt_file_inplace: %s was already processed, nothing to do. Remove %s to reverse it",
+                path, j.path);
+            ret = 0;
+            goto inplace_cleanup;
+        }
+
+        DEBUG_INFO("crypt_file_inplace: resuming %s at offset %llu", path, (unsigned long long)j.hdr.offset);
+
+        if (!journal_replay(&j, fd, buf)) {
+            goto inplace_cleanup;
+        }
+
+        if (crypt_advance_context(ctx, j.hdr.offset) != CRYPT_ERROR_OK || ctx->key_state != j.hdr.key_state) {
+            DEBUG_ERR("crypt_file_inplace: context state does not match journal");
+            goto inplace_cleanup;
+        }
+    } else if (journal_st.st_size > 0) {
+        // The journal exists but no slot is valid, blocks of the target may already be
+        //  encrypted, so starting over from offset 0 could encrypt them twice
+        DEBUG_ERR("crypt_file_inplace: journal %s is corrupt, refusing to run", j.path);
+        goto inplace_cleanup;
+    } else {
+        // New journal, nothing in the target has been touched yet
+        memset(&j.hdr, 0x00, sizeof(j.hdr));
+        j.hdr.magic = JOURNAL_MAGIC;
+        j.hdr.version = JOURNAL_VERSION;
+        j.hdr.file_size = (uint64_t)st.st_size;
+        j.hdr.key_salt = journal_salt();
+        j.hdr.key_hash = key_hash(j.hdr.key_salt, key, key_size);
+        j.hdr.key_size = key_size;
+        j.hdr.key_state = ctx->key_state;
+
+        if (!journal_commit(&j)) {
+            goto inplace_cleanup;
+        }
+    }
+
+    while (j.hdr.offset < j.hdr.file_size) {
+        uint64_t remaining = j.hdr.file_size - j.hdr.offset;
+        const uint32_t len = remaining > INPLACE_BLOCK_SIZE ? INPLACE_BLOCK_SIZE : (uint32_t)remaining;
+
+        if (!pread_full(fd, buf, len, (off_t)j.hdr.offset)) {
+            DEBUG_ERR("crypt_file_inplace: failed to read %s at offset %llu", path, (unsigned long long)j.hdr.offset);
+            goto inplace_cleanup;
+        }
+
+        if (!crypt_block(ctx, buf, len)) {
+            DEBUG_ERR("crypt_file_inplace: crypt_buffer failed");
+            goto inplace_cleanup;
+        }
+
+        if (!journal_stage(&j, buf, len)) {
+            goto inplace_cleanup;
+        }
+
+        if (!pwrite_full(fd, buf, len, (off_t)j.hdr.offset) || fdatasync(fd) != 0) {
+            DEBUG_ERR("crypt_file_inplace: failed to write %s at offset %llu", path, (unsigned long long)j.hdr.offset);
+            goto inplace_cleanup;
+        }
+
+        // Drop the written block from the page cache, so a pass over a large file does not
+        //  evict the working set of other processes
+        posix_fadvise(fd, (off_t)j.hdr.offset, len, POSIX_FADV_DONTNEED);
+
+        // The block is durable in the target, mark it committed
+        j.hdr.offset += len;
+        j.hdr.key_state = ctx->key_state;
+        j.hdr.pending_len = 0;
+        j.hdr.pending_hash = 0;
+
+        if (!journal_commit(&j)) {
+            goto inplace_cleanup;
+        }
+    }
+
+    DEBUG_INFO("crypt_file_inplace: processed %s (size: %llu)", path, (unsigned long long)j.hdr.file_size);
+
+    // Done, keep the journal as a completed marker so a repeated run is a no-op. The redo
+    //  areas are no longer needed, drop them so the marker holds no ciphertext
+    j.hdr.completed = 1;
+    if (!journal_commit(&j)) {
+        goto inplace_cleanup;
+    }
+
+    if (ftruncate(j.fd, 2 * JOURNAL_SLOT_SIZE) != 0 || fsync(j.fd) != 0) {
+        DEBUG_ERR("crypt_file_inplace: failed to truncate journal %s", j.path);
+        goto inplace_cleanup;
+    }
+    ret = 0;
+
+inplace_cleanup:
+    if (j.fd >= 0) {
+        close(j.fd);
+    }
+    if (buf) {
+        memset(buf, 0x00, INPLACE_BLOCK_SIZE);
+        free(buf);
+    }
+    free(j.path);
+    close(fd);
+    return ret;
+}
+
+//EOF
@@ -0,0 +1,19 @@
+#include <stdint.h>
+
+struct crypt_context;
+
+// Journal file is stored next to the target file: <path>.journal
+#define INPLACE_JOURNAL_SUFFIX                      ".journal"
+
+// Size of each block read, encrypted and written back with pread()/pwrite()
+#define INPLACE_BLOCK_SIZE                          (uint32_t)(1 << 20)
+
+// Encrypt (or decrypt) a file in place, in blocks of INPLACE_BLOCK_SIZE
+//  Progress is recorded in <path>.journal. If a previous run was interrupted, the journal
+//  is replayed and the run continues from the last committed offset. ctx must be freshly
+//  allocated from key; it is advanced to the resume offset internally.
+//  Once the whole file has been processed the journal is marked completed and kept, and
+//  further runs do nothing. The journal must be removed to process the file again (decrypt).
+//  A journal that exists but holds no valid header is refused.
+//  Returns 0 on success
+int32_t crypt_file_inplace(struct crypt_context *ctx, const char *path, const uint8_t *key, uint16_t key_size);
@@ -1,9 +1,189 @@
 #include "libcryptprov.h"
+#include "trace.h"
 
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
+
+// The key state repeats after every key byte has been incremented by its index 256 times,
+//  so one period of keystream is 256 * key_size bytes (at most 64770 bytes)
+#define KEYSTREAM_PERIOD(key_size)      (256 * (uint32_t)(key_size))
+
+// Number of hash buckets in the keystream cache
+#define KEYSTREAM_CACHE_BUCKETS         64
+
+// Input tile size for crypt_buffer_multi(), small enough to stay in L1 across all keys
+#define MULTI_TILE_SIZE                 4096
+
+struct crypt_keystream {
+    struct crypt_keystream              *next;
+    uint64_t                            hash;
+    uint32_t                            refcount;
+
+    uint8_t                             key[CRYPT_MAX_KEY_LEN];
+    uint16_t                            key_size;
+
+    // One period of keystream
+    uint32_t                            period;
+    uint8_t                             stream[];
+};
+
+// Process-wide keystream cache, keyed by a hash of the key. Entries are reference counted
+//  by the contexts using them, and are read-only once inserted.
+static struct crypt_keystream *keystream_cache[KEYSTREAM_CACHE_BUCKETS];
+static pthread_mutex_t keystream_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// 64-bit FNV-1a
+static uint64_t hash_key(const uint8_t *key, uint16_t key_size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (uint16_t i = 0; i < key_size; i++) {
+        hash ^= key[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+// Must be called with keystream_cache_lock held
+static struct crypt_keystream *keystream_find(uint64_t hash, const uint8_t *key, uint16_t key_size)
+{
+    struct crypt_keystream *ks = keystream_cache[hash % KEYSTREAM_CACHE_BUCKETS];
+
+    for (; ks; ks = ks->next) {
+        if (ks->hash == hash && ks->key_size == key_size && !memcmp(ks->key, key, key_size)) {
+            return ks;
+        }
+    }
+
+    return NULL;
+}
+
+// Runs the original key schedule for one period and records the XOR byte at each position
+static struct crypt_keystream *keystream_create(uint64_t hash, const uint8_t *key, uint16_t key_size)
+{
+    const uint32_t period = KEYSTREAM_PERIOD(key_size);
+
+    struct crypt_keystream *ks = calloc(1, sizeof(struct crypt_keystream) + period);
+    if (!ks) {
+        return NULL;
+    }
+
+    ks->hash = hash;
+    ks->refcount = 1;
+    ks->key_size = key_size;
+    ks->period = period;
+    memcpy(ks->key, key, key_size);
+
+    uint8_t key_ptr[CRYPT_MAX_KEY_LEN];
+    memcpy(key_ptr, key, key_size);
+
+    uint8_t i = 0;
+    for (uint32_t pos = 0; pos < period; pos++) {
+        key_ptr[i] = (key_ptr[i] + i) % 256;
+        ks->stream[pos] = key_ptr[i];
+        i = (i + 1) % key_size;
+    }
+
+    memset(key_ptr, 0x00, sizeof(key_ptr));
+    return ks;
+}
+
+// Returns a referenced keystream for key, computing and caching it if needed
+static struct crypt_keystream *keystream_acquire(const uint8_t *key, uint16_t key_size)
+{
+    const uint64_t hash = hash_key(key, key_size);
+
+    pthread_mutex_lock(&keystream_cache_lock);
+    struct crypt_keystream *ks = keystream_find(hash, key, key_size);
+    if (ks) {
+        ks->refcount++;
+        pthread_mutex_unlock(&keystream_cache_lock);
+        return ks;
+    }
+    pthread_mutex_unlock(&keystream_cache_lock);
+
+    // Compute outside of the lock so lookups for other keys are not held up
+    struct crypt_keystream *created = keystream_create(hash, key, key_size);
+    if (!created) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&keystream_cache_lock);
+    ks = keystream_find(hash, key, key_size);
+    if (ks) {
+        // Another thread inserted the same key in the meantime
+        ks->refcount++;
+    } else {
+        ks = created;
+        ks->next = keystream_cache[hash % KEYSTREAM_CACHE_BUCKETS];
+        keystream_cache[hash % KEYSTREAM_CACHE_BUCKETS] = ks;
+        created = NULL;
+    }
+    pthread_mutex_unlock(&keystream_cache_lock);
+
+    if (created) {
+        memset(created, 0x00, sizeof(struct crypt_keystream) + created->period);
+        free(created);
+    }
+
+    return ks;
+}
+
+// Drops a reference, the entry is removed from the cache and wiped when it reaches zero
+static void keystream_release(struct crypt_keystream *ks)
+{
+    if (!ks) {
+        return;
+    }
+
+    pthread_mutex_lock(&keystream_cache_lock);
+    if (--ks->refcount > 0) {
+        pthread_mutex_unlock(&keystream_cache_lock);
+        return;
+    }
+
+    struct crypt_keystream **link = &keystream_cache[ks->hash % KEYSTREAM_CACHE_BUCKETS];
+    while (*link != ks) {
+        link = &(*link)->next;
+    }
+    *link = ks->next;
+    pthread_mutex_unlock(&keystream_cache_lock);
+
+    memset(ks, 0x00, sizeof(struct crypt_keystream) + ks->period);
+    free(ks);
+}
+
+// XOR input with the keystream starting at ks_pos (within one period)
+//  Returns the keystream position following the last byte
+static uint32_t keystream_xor(const struct crypt_keystream *ks, uint8_t *output, const uint8_t *input,
+    uint32_t inputLen, uint32_t ks_pos)
+{
+    const uint8_t *stream = ks->stream;
+    const uint32_t period = ks->period;
+
+    for (uint32_t pos = 0; pos < inputLen; ) {
+        uint32_t chunk = inputLen - pos;
+        if (chunk > period - ks_pos) {
+            chunk = period - ks_pos;
+        }
+
+        for (uint32_t j = 0; j < chunk; j++) {
+            output[pos + j] = input[pos + j] ^ stream[ks_pos + j];
+        }
+
+        pos += chunk;
+        ks_pos += chunk;
+        if (ks_pos == period) {
+            ks_pos = 0;
+        }
+    }
+
+    return ks_pos;
+}
 
 int32_t crypt_alloc_context(struct crypt_context **ctx_out, const void *key, uint8_t key_size)
 {
@@ -31,6 +211,19 @@ int32_t crypt_alloc_context(struct crypt_context **ctx_out, const void *key, uin
     ctx->key_size = key_size;
     ctx->key_state = 0;
 
+    // An empty key is rejected later by crypt_buffer()
+    if (key_size > 0) {
+        ctx->keystream = keystream_acquire((const uint8_t *)key, key_size);
+        if (!ctx->keystream) {
+            free(ctx->key);
+            free(ctx);
+            return CRYPT_ERROR_NO_MEMORY;
+        }
+    }
+    ctx->keystream_pos = 0;
+
+    CRYPT_TRACE2(cryptprov, context_alloc, ctx, key_size);
+
     *ctx_out = ctx;
     return CRYPT_ERROR_OK;
 }
@@ -41,6 +234,10 @@ void crypt_free_context(struct crypt_context *ctx)
         return;
     }
 
+    CRYPT_TRACE1(cryptprov, context_free, ctx);
+
+    keystream_release(ctx->keystream);
+
     // zero out the key state just in case
     memset(ctx->key, 0x00, ctx->key_size);
     free(ctx->key);
@@ -50,34 +247,204 @@ void crypt_free_context(struct crypt_context *ctx)
     return;
 }
 
+int32_t crypt_advance_context(struct crypt_context *ctx, uint64_t len)
+{
+    if (!ctx || !ctx->keystream || ctx->key_size == 0 || ctx->key_size >= CRYPT_MAX_KEY_LEN) {
+        return CRYPT_ERROR_PARAMETER;
+    }
+
+    const uint32_t period = ctx->keystream->period;
+
+    ctx->keystream_pos = (uint32_t)((ctx->keystream_pos + (len % period)) % period);
+    ctx->key_state = (uint8_t)(ctx->keystream_pos % ctx->key_size);
+
+    return CRYPT_ERROR_OK;
+}
+
 uint32_t crypt_buffer(
     struct crypt_context *ctx,
     uint8_t *output,
     const uint8_t *input,
     uint32_t inputLen)
 {
+    CRYPT_TRACE3(cryptprov, crypt_buffer_entry, ctx, inputLen, ctx ? ctx->key_state : 0);
+
     // Sanity check
-    if (!ctx || !output || !input || inputLen == 0 || !ctx->key || ctx->key_size == 0) {
+    if (!ctx || !output || !input || inputLen == 0 || !ctx->key || ctx->key_size == 0 || !ctx->keystream) {
+        CRYPT_TRACE3(cryptprov, crypt_buffer_return, ctx, CRYPT_ERROR_PARAMETER, 0);
         return CRYPT_ERROR_PARAMETER;
     }
 
     if (inputLen > CRYPT_MAX_BUFFER_SIZE || ctx->key_size >= CRYPT_MAX_KEY_LEN) {
+        CRYPT_TRACE3(cryptprov, crypt_buffer_return, ctx, CRYPT_ERROR_NO_MEMORY, ctx->key_state);
         return CRYPT_ERROR_NO_MEMORY;
     }
 
-    const uint8_t key_size = ctx->key_size;
-    
-    // Key state is preserved in crypt_context
-    uint8_t *key_ptr = (uint8_t *)ctx->key;  
-    uint8_t i = ctx->key_state;
+    // Key state is preserved in crypt_context as a position in the shared keystream
+    const uint32_t ks_pos = keystream_xor(ctx->keystream, output, input, inputLen, ctx->keystream_pos);
 
-    for (uint32_t pos = 0; pos < inputLen; pos++) {
-        key_ptr[i] = (key_ptr[i] + i) % 256;
-        output[pos] = input[pos] ^ key_ptr[i];
-        i = (i + 1) % key_size;
+    ctx->keystream_pos = ks_pos;
+    ctx->key_state = (uint8_t)(ks_pos % ctx->key_size);
+
+    CRYPT_TRACE3(cryptprov, crypt_buffer_return, ctx, inputLen, ctx->key_state);
+
+    return inputLen;
+}
+
+uint32_t crypt_buffer_multi(
+    struct crypt_context **ctxs,
+    uint8_t **outputs,
+    uint32_t count,
+    const uint8_t *input,
+    uint32_t inputLen)
+{
+    if (!ctxs || !outputs || count == 0 || !input || inputLen == 0 || inputLen > CRYPT_MAX_BUFFER_SIZE) {
+        return 0;
+    }
+
+    // Validate everything up front so no context is advanced on failure
+    //  The input is read again for every context, so no output may overlap it
+    const uintptr_t in_start = (uintptr_t)input;
+    for (uint32_t k = 0; k < count; k++) {
+        if (!ctxs[k] || !ctxs[k]->keystream || !outputs[k]) {
+            return 0;
+        }
+
+        const uintptr_t out_start = (uintptr_t)outputs[k];
+        if (out_start < in_start + inputLen && in_start < out_start + inputLen) {
+            return 0;
+        }
+    }
+
+    for (uint32_t pos = 0; pos < inputLen; pos += MULTI_TILE_SIZE) {
+        uint32_t tile = inputLen - pos;
+        if (tile > MULTI_TILE_SIZE) {
+            tile = MULTI_TILE_SIZE;
+        }
+
+        for (uint32_t k = 0; k < count; k++) {
+            struct crypt_context *ctx = ctxs[k];
+            ctx->keystream_pos = keystream_xor(ctx->keystream, outputs[k] + pos, input + pos, tile, ctx->keystream_pos);
+        }
+    }
+
+    for (uint32_t k = 0; k < count; k++) {
+        ctxs[k]->key_state = (uint8_t)(ctxs[k]->keystream_pos % ctxs[k]->key_size);
+    }
+
+    return inputLen;
+}
+
+uint32_t crypt_buffer_records(
+    struct crypt_context *ctx,
+    struct crypt_record_state *state,
+    uint8_t *output,
+    const uint8_t *input,
+    uint32_t inputLen,
+    struct crypt_record *records,
+    uint32_t max_records,
+    uint32_t *records_out)
+{
+    if (!ctx || !state || !output || !input || inputLen == 0 || inputLen > CRYPT_MAX_BUFFER_SIZE ||
+            !records || max_records == 0 || !records_out) {
+        return 0;
+    }
+
+    // Find record boundaries first, then encrypt everything consumed in one call
+    uint32_t consumed = inputLen;
+    uint32_t count = 0;
+
+    for (uint32_t pos = 0; pos < inputLen; ) {
+        const uint8_t *nl = (const uint8_t *)memchr(input + pos, '\n', inputLen - pos);
+        if (!nl) {
+            break;
+        }
+
+        if (count == max_records) {
+            consumed = pos;
+            break;
+        }
+
+        const uint32_t end = (uint32_t)(nl - input) + 1;
+        const uint64_t record_end = state->stream_pos + end;
+
+        records[count].record = state->next_record++;
+        records[count].offset = state->record_start;
+        records[count].length = record_end - state->record_start;
+        count++;
+
+        state->record_start = record_end;
+        pos = end;
     }
 
-    ctx->key_state = i;
+    if (crypt_buffer(ctx, output, input, consumed) != consumed) {
+        return 0;
+    }
+
+    state->stream_pos += consumed;
+    *records_out = count;
+
+    return consumed;
+}
+
+int32_t crypt_record_finish(struct crypt_record_state *state, struct crypt_record *record_out)
+{
+    if (!state || !record_out || state->stream_pos == state->record_start) {
+        return 0;
+    }
+
+    record_out->record = state->next_record++;
+    record_out->offset = state->record_start;
+    record_out->length = state->stream_pos - state->record_start;
+
+    state->record_start = state->stream_pos;
+
+    return 1;
+}
+
+int32_t crypt_alloc_keystream(struct crypt_keystream **ks_out, const void *key, uint8_t key_size)
+{
+    if (!ks_out || !key || key_size == 0 || key_size >= CRYPT_MAX_KEY_LEN) {
+        return CRYPT_ERROR_PARAMETER;
+    }
+
+    struct crypt_keystream *ks = keystream_acquire((const uint8_t *)key, key_size);
+    if (!ks) {
+        return CRYPT_ERROR_NO_MEMORY;
+    }
+
+    *ks_out = ks;
+    return CRYPT_ERROR_OK;
+}
+
+void crypt_free_keystream(struct crypt_keystream *ks)
+{
+    keystream_release(ks);
+}
+
+uint32_t crypt_buffer_at(
+    const struct crypt_keystream *ks,
+    uint8_t *output,
+    const uint8_t *input,
+    uint32_t inputLen,
+    uint64_t offset)
+{
+    CRYPT_TRACE3(cryptprov, crypt_buffer_at_entry, ks, inputLen, offset);
+
+    // Same checks and return values as crypt_buffer()
+    if (!ks || !output || !input || inputLen == 0) {
+        CRYPT_TRACE2(cryptprov, crypt_buffer_at_return, ks, CRYPT_ERROR_PARAMETER);
+        return CRYPT_ERROR_PARAMETER;
+    }
+
+    if (inputLen > CRYPT_MAX_BUFFER_SIZE) {
+        CRYPT_TRACE2(cryptprov, crypt_buffer_at_return, ks, CRYPT_ERROR_NO_MEMORY);
+        return CRYPT_ERROR_NO_MEMORY;
+    }
+
+    keystream_xor(ks, output, input, inputLen, (uint32_t)(offset % ks->period));
+
+    CRYPT_TRACE2(cryptprov, crypt_buffer_at_return, ks, inputLen);
 
     return inputLen;
 }
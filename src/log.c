@@ -0,0 +1,224 @@
+// pthreads, clock_gettime()
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "log.h"
+
+// Bounded multi-producer queue (Vyukov). Each slot carries a sequence number:
+//  seq == pos              slot is free for the producer claiming pos
+//  seq == pos + 1          slot holds the message for pos, ready for the writer
+//  The writer releases a slot by setting seq to pos + LOG_RING_SLOTS.
+// Producers claim positions with a CAS and never wait. When the ring is full the message
+//  is dropped and counted.
+struct log_slot {
+    uint32_t                        seq;
+    int32_t                         level;
+    char                            msg[LOG_MSG_SIZE];
+};
+
+// Writer sleeps at most this long when the ring is empty
+#define LOG_IDLE_WAIT_NS                            (50 * 1000 * 1000)
+
+int32_t log_level = LOG_LEVEL_INFO;
+
+static struct log_slot log_ring[LOG_RING_SLOTS];
+static uint32_t log_enqueue_pos;
+static uint32_t log_dequeue_pos;
+static uint32_t log_dropped;
+
+static FILE *log_out;
+static pthread_t log_thread;
+static bool log_running;
+static bool log_stopping;
+static bool log_writer_idle;
+
+static pthread_mutex_t log_idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_idle_cond = PTHREAD_COND_INITIALIZER;
+
+static const char *log_prefix(int32_t level)
+{
+    return level == LOG_LEVEL_ERROR ? "[crypt!]: " : "[crypt+]: ";
+}
+
+// Write out everything that has been published, returns the number of messages written
+static uint32_t log_drain(void)
+{
+    uint32_t count = 0;
+
+    for (;;) {
+        struct log_slot *slot = &log_ring[log_dequeue_pos & (LOG_RING_SLOTS - 1)];
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != log_dequeue_pos + 1) {
+            break;
+        }
+
+        fputs(log_prefix(slot->level), log_out);
+        fputs(slot->msg, log_out);
+        fputc('\n', log_out);
+
+        __atomic_store_n(&slot->seq, log_dequeue_pos + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+        log_dequeue_pos++;
+        count++;
+    }
+
+    const uint32_t dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+        fprintf(log_out, "%slog: dropped %u messages\n", log_prefix(LOG_LEVEL_ERROR), dropped);
+    }
+
+    if (count || dropped) {
+        fflush(log_out);
+    }
+
+    return count;
+}
+
+static void *log_writer(void *arg)
+{
+    (void)arg;
+
+    for (;;) {
+        if (log_drain()) {
+            continue;
+        }
+
+        if (__atomic_load_n(&log_stopping, __ATOMIC_ACQUIRE)) {
+            log_drain();
+            break;
+        }
+
+        // Producers signal when they see the writer idle, the timeout covers a missed wakeup
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOG_IDLE_WAIT_NS;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&log_idle_lock);
+        __atomic_store_n(&log_writer_idle, true, __ATOMIC_SEQ_CST);
+        pthread_cond_timedwait(&log_idle_cond, &log_idle_lock, &deadline);
+        __atomic_store_n(&log_writer_idle, false, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&log_idle_lock);
+    }
+
+    return NULL;
+}
+
+int32_t log_init(int32_t level, const char *path)
+{
+    log_level = level;
+
+    if (log_running) {
+        return 0;
+    }
+
+    log_out = stderr;
+    if (path) {
+        log_out = fopen(path, "a");
+        if (!log_out) {
+            log_out = stderr;
+            log_write(LOG_LEVEL_ERROR, "log: failed to open %s, using stderr", path);
+        }
+    }
+
+    for (uint32_t i = 0; i < LOG_RING_SLOTS; i++) {
+        log_ring[i].seq = i;
+    }
+    log_enqueue_pos = 0;
+    log_dequeue_pos = 0;
+    log_stopping = false;
+
+    if (pthread_create(&log_thread, NULL, log_writer, NULL) != 0) {
+        log_write(LOG_LEVEL_ERROR, "log: failed to start writer thread");
+        return -1;
+    }
+
+    __atomic_store_n(&log_running, true, __ATOMIC_RELEASE);
+    atexit(log_shutdown);
+
+    return 0;
+}
+
+void log_shutdown(void)
+{
+    if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    __atomic_store_n(&log_stopping, true, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&log_idle_lock);
+    pthread_cond_signal(&log_idle_cond);
+    pthread_mutex_unlock(&log_idle_lock);
+
+    pthread_join(log_thread, NULL);
+    __atomic_store_n(&log_running, false, __ATOMIC_RELEASE);
+
+    if (log_out != stderr) {
+        fclose(log_out);
+    }
+    log_out = NULL;
+}
+
+void log_vwrite(int32_t level, const char *format, va_list args)
+{
+    if (!format) {
+        return;
+    }
+
+    if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+        // No writer thread, write synchronously
+        fputs(log_prefix(level), stderr);
+        vfprintf(stderr, format, args);
+        fputc('\n', stderr);
+        return;
+    }
+
+    uint32_t pos = __atomic_load_n(&log_enqueue_pos, __ATOMIC_RELAXED);
+    struct log_slot *slot;
+
+    for (;;) {
+        slot = &log_ring[pos & (LOG_RING_SLOTS - 1)];
+        const int32_t dif = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&log_enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            // Full, never block the caller
+            __atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&log_enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->level = level;
+    vsnprintf(slot->msg, LOG_MSG_SIZE, format, args);
+
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    if (__atomic_load_n(&log_writer_idle, __ATOMIC_SEQ_CST)) {
+        pthread_cond_signal(&log_idle_cond);
+    }
+}
+
+void log_write(int32_t level, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    log_vwrite(level, format, args);
+    va_end(args);
+}
+
+//EOF
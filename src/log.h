@@ -0,0 +1,48 @@
+#include <stdint.h>
+#include <stdarg.h>
+
+// Leveled logger
+//  Messages are formatted by the caller into a lock-free ring buffer and written to stderr
+//  or a log file by a background thread, so logging never writes to stdout and does not
+//  block the data path. Until log_init() is called messages are written to stderr directly.
+//  A disabled level costs a single compare, arguments are not evaluated.
+
+enum {
+    LOG_LEVEL_ERROR = 1,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG
+};
+
+// Levels above this are compiled out
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL                               LOG_LEVEL_DEBUG
+#endif
+
+// Number of messages the ring buffer holds, must be a power of 2
+#define LOG_RING_SLOTS                              256
+
+// Maximum formatted message length, longer messages are truncated
+#define LOG_MSG_SIZE                                256
+
+// Current runtime level, set through log_init()
+extern int32_t log_level;
+
+#define LOG_ENABLED(level)                          ((level) <= LOG_MAX_LEVEL && (level) <= log_level)
+
+#define LOG_WRITE(level, fmt, ...) \
+    do { \
+        if (LOG_ENABLED(level)) { \
+            log_write(level, fmt, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+// Start the background writer. path may be NULL for stderr, otherwise the file is appended to
+//  Flushes and stops automatically at exit
+//  Returns 0 on success, on failure messages keep going to stderr synchronously
+int32_t log_init(int32_t level, const char *path);
+
+// Drain outstanding messages and stop the background writer
+void log_shutdown(void);
+
+void log_write(int32_t level, const char *format, ...);
+void log_vwrite(int32_t level, const char *format, va_list args);
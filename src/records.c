@@ -0,0 +1,138 @@
+// fseeko()
+#define _POSIX_C_SOURCE 200112L
+#define _FILE_OFFSET_BITS 64
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "libcryptprov.h"
+#include "records.h"
+#include "util.h"
+#include "throttle.h"
+
+// Entries are serialized in batches, one write_to_file() per batch
+#define RECORD_INDEX_BATCH                          256
+
+bool records_create_index(const char *path)
+{
+    if (!path) {
+        return false;
+    }
+
+    FILE *fp = fopen(path, "ab");
+    if (!fp) {
+        DEBUG_ERR("records_create_index: failed to open %s", path);
+        return false;
+    }
+
+    const bool empty = fseeko(fp, 0, SEEK_END) == 0 && ftello(fp) == 0;
+    fclose(fp);
+
+    if (!empty) {
+        DEBUG_ERR("records_create_index: %s already holds an index, refusing to append to it", path);
+    }
+
+    return empty;
+}
+
+bool records_write_index(const char *path, const struct crypt_record *records, uint32_t count)
+{
+    if (!path || (!records && count)) {
+        return false;
+    }
+
+    uint8_t batch[RECORD_INDEX_BATCH * RECORD_INDEX_ENTRY_SIZE];
+
+    while (count > 0) {
+        const uint32_t n = count > RECORD_INDEX_BATCH ? RECORD_INDEX_BATCH : count;
+
+        for (uint32_t i = 0; i < n; i++) {
+            uint8_t *entry = batch + (i * RECORD_INDEX_ENTRY_SIZE);
+
+            if (records[i].length > UINT32_MAX) {
+                DEBUG_ERR("records_write_index: record %llu is too long", (unsigned long long)records[i].record);
+                return false;
+            }
+
+            for (uint32_t b = 0; b < 8; b++) {
+                entry[b] = (uint8_t)(records[i].offset >> (8 * b));
+            }
+            for (uint32_t b = 0; b < 4; b++) {
+                entry[8 + b] = (uint8_t)(records[i].length >> (8 * b));
+            }
+        }
+
+        const uint32_t size = n * RECORD_INDEX_ENTRY_SIZE;
+        if (write_to_file(path, batch, size) != size) {
+            DEBUG_ERR("records_write_index: failed to write %s", path);
+            return false;
+        }
+        throttle_write(size);
+
+        records += n;
+        count -= n;
+    }
+
+    return true;
+}
+
+bool records_read_index(const char *path, uint64_t record, struct crypt_record *out)
+{
+    if (!path || !out) {
+        return false;
+    }
+
+    // The entry offset must not wrap around to an earlier entry
+    if (record > UINT64_MAX / RECORD_INDEX_ENTRY_SIZE) {
+        return false;
+    }
+
+    uint8_t entry[RECORD_INDEX_ENTRY_SIZE];
+    if (!records_read_at(path, record * RECORD_INDEX_ENTRY_SIZE, entry, sizeof(entry))) {
+        return false;
+    }
+
+    out->record = record;
+    out->offset = 0;
+    out->length = 0;
+
+    for (uint32_t b = 0; b < 8; b++) {
+        out->offset |= (uint64_t)entry[b] << (8 * b);
+    }
+    for (uint32_t b = 0; b < 4; b++) {
+        out->length |= (uint64_t)entry[8 + b] << (8 * b);
+    }
+
+    // Every record holds at least one byte, an empty entry is not from records_write_index()
+    if (out->length == 0) {
+        DEBUG_ERR("records_read_index: entry for record %llu in %s is empty", (unsigned long long)record, path);
+        return false;
+    }
+
+    return true;
+}
+
+bool records_read_at(const char *path, uint64_t offset, uint8_t *buf, uint32_t len)
+{
+    if (!path || !buf) {
+        return false;
+    }
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        DEBUG_ERR("records_read_at: failed to open %s", path);
+        return false;
+    }
+
+    bool res = fseeko(fp, (off_t)offset, SEEK_SET) == 0 && fread(buf, 1, len, fp) == len;
+
+    fclose(fp);
+    throttle_read(len);
+    return res;
+}
+
+//EOF
@@ -0,0 +1,27 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+struct crypt_record;
+
+// Record index file (-r), one entry per record, the record number is the entry position:
+//  [stream offset: 8 bytes LE][length: 4 bytes LE]
+#define RECORD_INDEX_ENTRY_SIZE                     12
+
+// Create an empty index at path, or accept an existing empty file
+//  An index describes exactly one encrypted stream with offsets from 0, so a path that
+//  already holds entries is refused rather than appended to
+//  Returns false on failure or if the index is not empty
+bool records_create_index(const char *path);
+
+// Append index entries to path, create the file if it does not exist
+//  Records must be numbered consecutively from the current end of the index
+//  Returns false on failure, or if a record is longer than 4 GiB
+bool records_write_index(const char *path, const struct crypt_record *records, uint32_t count);
+
+// Look up a record in the index at path
+//  Returns false if the record is not in the index, or its entry is invalid (length 0)
+bool records_read_index(const char *path, uint64_t record, struct crypt_record *out);
+
+// Read exactly len bytes at offset from the file at path
+//  Returns false on failure or short read
+bool records_read_at(const char *path, uint64_t offset, uint8_t *buf, uint32_t len);
@@ -12,6 +12,15 @@
 #define DECRYPT_AND_PRINT(x) decrypt_and_print(ctx, x, sizeof(x) / sizeof(uint8_t))
 static uint32_t decrypt_and_print(struct crypt_context *ctx, const uint8_t *buf, uint32_t buf_size);
 
+// Checks that crypt_advance_context() lands on the same key state as crypt_buffer()
+static bool test_advance_context(uint32_t skip);
+
+// Checks that contexts sharing a cached keystream keep independent positions
+static bool test_shared_keystream(void);
+
+// Checks that crypt_buffer_at() matches a context positioned at the same offset
+static bool test_buffer_at(void);
+
 static const uint8_t key[] = { 
     0xc1, 0xab, 0xe5, 0xec, 0x1e, 0x7a 
 };
@@ -85,9 +94,140 @@ int main(void)
     crypt_free_context(ctx);
     ctx = NULL;
 
+    // Offsets inside the first period, on a period boundary, and past it
+    const uint32_t skips[] = { 1, 5, 6, 256 * 6, 256 * 6 + 7, 5000 };
+    for (uint32_t i = 0; i < sizeof(skips) / sizeof(uint32_t); i++) {
+        if (!test_advance_context(skips[i])) {
+            return -1;
+        }
+    }
+
+    if (!test_shared_keystream() || !test_buffer_at()) {
+        return -1;
+    }
+
     return 0;
 }
 
+static bool test_buffer_at(void)
+{
+    struct crypt_context *ctx = NULL;
+    struct crypt_keystream *ks = NULL;
+    uint8_t expected[sizeof(coded3)], out[sizeof(coded3)];
+    bool res = false;
+
+    if (crypt_alloc_context(&ctx, key, key_size) != CRYPT_ERROR_OK ||
+            crypt_alloc_keystream(&ks, key, key_size) != CRYPT_ERROR_OK) {
+        DEBUG_ERR("test_buffer_at: failed to create crypt_context or crypt_keystream");
+        goto buffer_at_cleanup;
+    }
+
+    crypt_buffer(ctx, expected, coded1, sizeof(coded1));
+    crypt_buffer(ctx, expected, coded2, sizeof(coded2));
+    crypt_buffer(ctx, expected, coded3, sizeof(coded3));
+
+    // Out of order, no state is carried between the calls
+    crypt_buffer_at(ks, out, coded3, sizeof(coded3), sizeof(coded1) + sizeof(coded2));
+    if (memcmp(expected, out, sizeof(coded3))) {
+        DEBUG_ERR("test_buffer_at failed");
+        goto buffer_at_cleanup;
+    }
+
+    crypt_buffer_at(ks, out, coded1, sizeof(coded1), 0);
+    crypt_buffer_at(ks, out + sizeof(coded1), coded3 + sizeof(coded1), sizeof(coded3) - sizeof(coded1),
+        sizeof(coded1) + sizeof(coded2) + sizeof(coded1));
+    if (memcmp(expected + sizeof(coded1), out + sizeof(coded1), sizeof(coded3) - sizeof(coded1))) {
+        DEBUG_ERR("test_buffer_at failed");
+        goto buffer_at_cleanup;
+    }
+
+    DEBUG_INFO("test_buffer_at success");
+    res = true;
+
+buffer_at_cleanup:
+    crypt_free_context(ctx);
+    crypt_free_keystream(ks);
+    return res;
+}
+
+static bool test_shared_keystream(void)
+{
+    struct crypt_context *first = NULL, *second = NULL;
+    uint8_t first_out[sizeof(coded2)], second_out[sizeof(coded2)];
+    bool res = false;
+
+    if (crypt_alloc_context(&first, key, key_size) != CRYPT_ERROR_OK ||
+            crypt_alloc_context(&second, key, key_size) != CRYPT_ERROR_OK) {
+        DEBUG_ERR("test_shared_keystream: failed to create crypt_context");
+        goto shared_cleanup;
+    }
+
+    // Interleave calls, each context must still decode its own stream
+    crypt_buffer(first, first_out, coded1, sizeof(coded1));
+    crypt_buffer(second, second_out, coded1, sizeof(coded1));
+    crypt_buffer(first, first_out, coded2, sizeof(coded2));
+
+    crypt_free_context(second);
+    second = NULL;
+
+    if (crypt_alloc_context(&second, key, key_size) != CRYPT_ERROR_OK) {
+        DEBUG_ERR("test_shared_keystream: failed to create crypt_context");
+        goto shared_cleanup;
+    }
+
+    crypt_buffer(second, second_out, coded1, sizeof(coded1));
+    crypt_buffer(second, second_out, coded2, sizeof(coded2));
+
+    if (memcmp(first_out, second_out, sizeof(coded2))) {
+        DEBUG_ERR("test_shared_keystream failed");
+        goto shared_cleanup;
+    }
+
+    DEBUG_INFO("test_shared_keystream success");
+    res = true;
+
+shared_cleanup:
+    crypt_free_context(first);
+    crypt_free_context(second);
+    return res;
+}
+
+static bool test_advance_context(uint32_t skip)
+{
+    struct crypt_context *walked = NULL, *advanced = NULL;
+    uint8_t buf[64] = { 0 }, walked_out[64], advanced_out[64];
+    bool res = false;
+
+    if (crypt_alloc_context(&walked, key, key_size) != CRYPT_ERROR_OK ||
+            crypt_alloc_context(&advanced, key, key_size) != CRYPT_ERROR_OK) {
+        DEBUG_ERR("test_advance_context: failed to create crypt_context");
+        goto advance_cleanup;
+    }
+
+    for (uint32_t pos = 0; pos < skip; pos += sizeof(buf)) {
+        const uint32_t len = (skip - pos) < sizeof(buf) ? (skip - pos) : sizeof(buf);
+        crypt_buffer(walked, buf, buf, len);
+    }
+    crypt_advance_context(advanced, skip);
+
+    memset(buf, 0x00, sizeof(buf));
+    crypt_buffer(walked, walked_out, buf, sizeof(buf));
+    crypt_buffer(advanced, advanced_out, buf, sizeof(buf));
+
+    if (memcmp(walked_out, advanced_out, sizeof(buf))) {
+        DEBUG_ERR("crypt_advance_context failed, skip: %d", skip);
+        goto advance_cleanup;
+    }
+
+    DEBUG_INFO("crypt_advance_context success, skip: %d", skip);
+    res = true;
+
+advance_cleanup:
+    crypt_free_context(walked);
+    crypt_free_context(advanced);
+    return res;
+}
+
 static uint32_t decrypt_and_print(struct crypt_context *ctx, const uint8_t *buf, uint32_t buf_size)
 {
     if (!ctx || !buf || buf_size == 0) {
@@ -0,0 +1,207 @@
+// clock_gettime(), nanosleep(), syscall()
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "throttle.h"
+#include "log.h"
+
+// Linux ioprio, from include/uapi/linux/ioprio.h
+#define IOPRIO_CLASS_SHIFT                          13
+#define IOPRIO_PRIO_VALUE(class, data)              (((class) << IOPRIO_CLASS_SHIFT) | (data))
+#define IOPRIO_WHO_PROCESS                          1
+#define IOPRIO_CLASS_BE                             2
+#define IOPRIO_CLASS_IDLE                           3
+
+struct token_bucket {
+    double                          tokens;
+    struct timespec                 last;
+};
+
+static uint64_t throttle_rate;
+static double throttle_burst;
+static struct token_bucket read_bucket;
+static struct token_bucket write_bucket;
+
+static double elapsed_sec(const struct timespec *from, const struct timespec *to)
+{
+    return (double)(to->tv_sec - from->tv_sec) + (double)(to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+void throttle_set_rate(uint64_t bytes_per_sec)
+{
+    throttle_rate = bytes_per_sec;
+    throttle_burst = (double)bytes_per_sec * THROTTLE_BURST_MS / 1000.0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    read_bucket.tokens = throttle_burst;
+    read_bucket.last = now;
+    write_bucket.tokens = throttle_burst;
+    write_bucket.last = now;
+}
+
+static void bucket_take(struct token_bucket *b, uint64_t bytes)
+{
+    if (!throttle_rate || !bytes) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // Refill for the time since the last call, capped at the burst size
+    b->tokens += elapsed_sec(&b->last, &now) * (double)throttle_rate;
+    if (b->tokens > throttle_burst) {
+        b->tokens = throttle_burst;
+    }
+    b->last = now;
+
+    b->tokens -= (double)bytes;
+    if (b->tokens >= -(double)throttle_rate * THROTTLE_MIN_SLEEP_MS / 1000.0) {
+        return;
+    }
+
+    // In debt, wait until it has been refilled
+    const double wait = -b->tokens / (double)throttle_rate;
+    struct timespec ts = {
+        .tv_sec = (time_t)wait,
+        .tv_nsec = (long)((wait - (double)(time_t)wait) * 1e9)
+    };
+
+    while (nanosleep(&ts, &ts) != 0) {
+        continue;
+    }
+}
+
+void throttle_read(uint64_t bytes)
+{
+    bucket_take(&read_bucket, bytes);
+}
+
+void throttle_write(uint64_t bytes)
+{
+    bucket_take(&write_bucket, bytes);
+}
+
+bool throttle_set_priority(int32_t priority)
+{
+    int32_t ioprio = 0, nice_value = 0;
+
+    switch (priority) {
+    case THROTTLE_PRIORITY_NORMAL:
+        return true;
+    case THROTTLE_PRIORITY_LOW:
+        ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 7);
+        nice_value = 10;
+        break;
+    case THROTTLE_PRIORITY_IDLE:
+        ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0);
+        nice_value = 19;
+        break;
+    default:
+        return false;
+    }
+
+    bool res = true;
+
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) != 0) {
+        LOG_WRITE(LOG_LEVEL_ERROR, "throttle: failed to set I/O priority");
+        res = false;
+    }
+#else
+    (void)ioprio;
+    LOG_WRITE(LOG_LEVEL_INFO, "throttle: I/O priority is not supported on this platform");
+#endif
+
+    if (setpriority(PRIO_PROCESS, 0, nice_value) != 0) {
+        LOG_WRITE(LOG_LEVEL_ERROR, "throttle: failed to set CPU priority");
+        res = false;
+    }
+
+    return res;
+}
+
+bool throttle_parse_rate(const char *s, uint64_t *rate_out)
+{
+    if (!s || !rate_out || s[0] < '0' || s[0] > '9') {
+        return false;
+    }
+
+    char *end = NULL;
+    errno = 0;
+    uint64_t rate = strtoull(s, &end, 10);
+    if (errno == ERANGE) {
+        return false;
+    }
+
+    // Number of x1024 steps for the suffix
+    uint32_t steps = 0;
+    switch (*end) {
+    case 'G':
+    case 'g':
+        steps++;
+        // fallthrough
+    case 'M':
+    case 'm':
+        steps++;
+        // fallthrough
+    case 'K':
+    case 'k':
+        steps++;
+        end++;
+        break;
+    default:
+        break;
+    }
+
+    for (uint32_t i = 0; i < steps; i++) {
+        if (rate > UINT64_MAX / 1024) {
+            return false;
+        }
+        rate *= 1024;
+    }
+
+    if (*end != '\0') {
+        return false;
+    }
+
+    *rate_out = rate;
+    return true;
+}
+
+bool throttle_parse_priority(const char *s, int32_t *priority_out)
+{
+    if (!s || !priority_out) {
+        return false;
+    }
+
+    if (!strcmp(s, "normal")) {
+        *priority_out = THROTTLE_PRIORITY_NORMAL;
+    } else if (!strcmp(s, "low")) {
+        *priority_out = THROTTLE_PRIORITY_LOW;
+    } else if (!strcmp(s, "idle")) {
+        *priority_out = THROTTLE_PRIORITY_IDLE;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+//EOF
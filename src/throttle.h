@@ -0,0 +1,39 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+// Token bucket rate limiting for the CLI read and write paths
+//  Reads and writes each get their own bucket filled at the configured rate. A caller that
+//  takes more than is available sleeps until the debt is paid back, so large chunks are
+//  allowed but the long-term rate holds. A rate of 0 disables throttling.
+
+// Bucket capacity, as a fraction of one second of the rate
+#define THROTTLE_BURST_MS                           100
+
+// Debt below this much time at the rate is carried instead of sleeping, so small chunks
+//  do not cost a nanosleep() each
+#define THROTTLE_MIN_SLEEP_MS                       2
+
+// I/O and CPU priority classes for -p
+enum {
+    THROTTLE_PRIORITY_NORMAL,
+    THROTTLE_PRIORITY_LOW,      // Best-effort I/O at the lowest level, nice 10
+    THROTTLE_PRIORITY_IDLE      // Idle I/O class, only served when the disk is otherwise idle, nice 19
+};
+
+// Set the byte rate for reads and writes, 0 disables
+void throttle_set_rate(uint64_t bytes_per_sec);
+
+// Account for bytes read or written, sleeps if over the rate
+void throttle_read(uint64_t bytes);
+void throttle_write(uint64_t bytes);
+
+// Apply an I/O scheduling class (Linux ioprio) and CPU nice value to the process
+//  Returns false if the kernel rejected it
+bool throttle_set_priority(int32_t priority);
+
+// Parse a byte rate with an optional K, M or G suffix (powers of 1024)
+//  Returns false if the string is not a valid rate, or the rate does not fit in 64 bits
+bool throttle_parse_rate(const char *s, uint64_t *rate_out);
+
+// Parse a priority name: normal, low or idle
+bool throttle_parse_priority(const char *s, int32_t *priority_out);
@@ -0,0 +1,28 @@
+#include <stdint.h>
+
+// USDT (user statically-defined tracing) probes
+//  Probes are compiled in when <sys/sdt.h> is available (systemtap-sdt-dev on Debian/Ubuntu,
+//  systemtap-sdt-devel on Fedora). Each probe is a single nop plus an ELF note, and arguments
+//  are read by a tracer (perf, bpftrace) only when it attaches. Build with -DCRYPT_NO_USDT to
+//  remove them entirely. When <sys/sdt.h> is missing the macros expand to nothing.
+//
+//  List probes:    bpftrace -l 'usdt:../bin/crypt:*'
+//  Example:        bpftrace -e 'usdt:../lib/libcryptprov.so:cryptprov:crypt_buffer_entry { @[arg2] = count(); }'
+#if !defined(CRYPT_NO_USDT) && defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define CRYPT_USDT_ENABLED
+#endif
+#endif
+
+#ifdef CRYPT_USDT_ENABLED
+#define CRYPT_TRACE0(provider, name)                    DTRACE_PROBE(provider, name)
+#define CRYPT_TRACE1(provider, name, a1)                DTRACE_PROBE1(provider, name, a1)
+#define CRYPT_TRACE2(provider, name, a1, a2)            DTRACE_PROBE2(provider, name, a1, a2)
+#define CRYPT_TRACE3(provider, name, a1, a2, a3)        DTRACE_PROBE3(provider, name, a1, a2, a3)
+#else
+#define CRYPT_TRACE0(provider, name)                    do { } while (0)
+#define CRYPT_TRACE1(provider, name, a1)                do { } while (0)
+#define CRYPT_TRACE2(provider, name, a1, a2)            do { } while (0)
+#define CRYPT_TRACE3(provider, name, a1, a2, a3)        do { } while (0)
+#endif
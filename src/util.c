@@ -10,21 +10,14 @@
 
 void debug(bool is_error, const char *format, ...) 
 {
-    fflush(stdout);
+    const int32_t level = is_error ? LOG_LEVEL_ERROR : LOG_LEVEL_INFO;
+    if (!LOG_ENABLED(level)) {
+        return;
+    }
 
     va_list args;
     va_start(args, format);
-
-    if (is_error) {
-        printf("[crypt!]: ");
-    } else {
-        printf("[crypt+]: ");
-    }
-
-    vprintf(format, args);
-
-    printf("\n");
-
+    log_vwrite(level, format, args);
     va_end(args);
 }
 
@@ -84,7 +77,7 @@ uint32_t read_file_into_memory(const char *path, uint8_t **out)
         return 0;
     }
 
-    DEBUG_INFO("read_file: Successfully read file %s size: %d", path, res);
+    DEBUG_VERBOSE("read_file: Successfully read file %s size: %d", path, res);
 
     fclose(fp);
     *out = buf;
@@ -164,23 +157,15 @@ uint32_t read_from_stdin(uint8_t *buf, uint32_t buf_max_size)
         return 0;
     }
 
-    uint32_t total_read = 0;
-    int8_t ch;
-
-    while (total_read < buf_max_size) {
-        ch = fgetc(stdin);
-        if (ch == EOF || feof(stdin)) {
-            DEBUG_INFO("read_from_stdin: Received EOF");
-            break;
-        }
+    // fread() blocks until the buffer is full or EOF, binary data (0xff) is not mistaken for EOF
+    const uint32_t total_read = (uint32_t)fread(buf, 1, buf_max_size, stdin);
 
+    if (total_read < buf_max_size) {
         if (ferror(stdin)) {
             DEBUG_ERR("I/O error reading from stdin");
-            break;
+        } else {
+            DEBUG_VERBOSE("read_from_stdin: Received EOF");
         }
-
-        buf[total_read] = ch;
-        total_read++;
     }
 
     return total_read;
@@ -1,14 +1,19 @@
 #include <stdbool.h>
 
+#include "log.h"
+
 #define MAX_FILE_BUF_SIZE                           65535
 
 // This will be MAX_PATH on Win32
 #define MAX_FILE_PATH                               255
 
-#define DEBUG_ERR(fmt, ...) debug(true, fmt, ##__VA_ARGS__);
-#define DEBUG_INFO(fmt, ...) debug(false, fmt, ##__VA_ARGS__);
+#define DEBUG_ERR(fmt, ...) LOG_WRITE(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__);
+#define DEBUG_INFO(fmt, ...) LOG_WRITE(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__);
+
+// Per-chunk messages on the data path, only shown with -v
+#define DEBUG_VERBOSE(fmt, ...) LOG_WRITE(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__);
 
-// Debugging function
+// Debugging function, routed through the logger (see log.h)
 void debug(bool is_error, const char *format, ...);
 
 // Validate path sanity
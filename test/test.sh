@@ -1,6 +1,7 @@
 #!/bin/bash
 
 TESTCRYPT_PATH="../bin/testcrypt"
+DIFFCRYPT_PATH="../bin/diffcrypt"
 CRYPT_PATH="../bin/crypt"
 
 generate_random_ascii_string() {
@@ -38,6 +39,13 @@ sleep 2
 $TESTCRYPT_PATH
 sleep 2
 
+# Compare every optimized crypt path against the reference loop, benchmark skipped
+echo "[+] Running diffcrypt..."
+if ! $DIFFCRYPT_PATH -n; then
+    echo "[!] diffcrypt found a mismatch"
+    exit 1
+fi
+
 echo "[+] Using random key: "$CRYPT_KEY
 CRYPT_KEY_PATH="../test_files/test.key"
 echo "[+] Writing key to: "$CRYPT_KEY_PATH
@@ -63,4 +71,174 @@ echo "[+] Inverting encryption, sending to stdout"
 echo "crypt -k $CRYPT_KEY $CRYPT_OUT_FILE"
 $CRYPT_PATH -k $CRYPT_KEY $CRYPT_OUT_FILE
 
+echo "[+] Testing crypt in place, encrypt, repeat (no-op) and decrypt after removing the journal"
+CRYPT_INPLACE_FILE="../test_files/inplace.dat"
+CRYPT_INPLACE_JOURNAL="$CRYPT_INPLACE_FILE.journal"
+rm -f $CRYPT_INPLACE_FILE $CRYPT_INPLACE_JOURNAL
+cp $CRYPT_IN_FILE $CRYPT_INPLACE_FILE
+echo "crypt -k $CRYPT_KEY -i $CRYPT_INPLACE_FILE"
+$CRYPT_PATH -k $CRYPT_KEY -i $CRYPT_INPLACE_FILE
+$CRYPT_PATH -q -k $CRYPT_KEY -i $CRYPT_INPLACE_FILE
+if ! cmp -s $CRYPT_OUT_FILE $CRYPT_INPLACE_FILE || [ ! -f "$CRYPT_INPLACE_JOURNAL" ]; then
+    echo "[!] Repeating a completed in place run changed the file"
+    exit 1
+fi
+if [ "$(stat -c %s $CRYPT_INPLACE_JOURNAL)" != "1024" ]; then
+    echo "[!] Completed in place journal still holds redo blocks"
+    exit 1
+fi
+rm -f $CRYPT_INPLACE_JOURNAL
+$CRYPT_PATH -q -k $CRYPT_KEY -i $CRYPT_INPLACE_FILE
+if ! cmp -s $CRYPT_IN_FILE $CRYPT_INPLACE_FILE; then
+    echo "[!] In place round trip failed"
+    exit 1
+fi
+
+echo "[+] Testing crypt in place refuses a corrupt journal"
+rm -f $CRYPT_INPLACE_JOURNAL
+head -c 1024 /dev/urandom > $CRYPT_INPLACE_JOURNAL
+if $CRYPT_PATH -q -k $CRYPT_KEY -i $CRYPT_INPLACE_FILE || ! cmp -s $CRYPT_IN_FILE $CRYPT_INPLACE_FILE; then
+    echo "[!] In place run did not refuse a corrupt journal"
+    exit 1
+fi
+rm -f $CRYPT_INPLACE_FILE $CRYPT_INPLACE_JOURNAL
+
+echo "[+] Testing crypt in place resume, kill a throttled multi-block run and repeat it"
+CRYPT_INPLACE_REF="../test_files/inplace_ref.dat"
+CRYPT_INPLACE_SRC="../test_files/inplace_src.dat"
+rm -f $CRYPT_INPLACE_REF $CRYPT_INPLACE_SRC
+head -c $((6 * 1024 * 1024 + 12345)) /dev/urandom > $CRYPT_INPLACE_SRC
+cp $CRYPT_INPLACE_SRC $CRYPT_INPLACE_FILE
+$CRYPT_PATH -q -k $CRYPT_KEY -o $CRYPT_INPLACE_REF < $CRYPT_INPLACE_SRC
+for KILL_AFTER in 2 2; do
+    echo "crypt -b 1M -k $CRYPT_KEY -i $CRYPT_INPLACE_FILE (killed after ${KILL_AFTER}s)"
+    timeout -s KILL $KILL_AFTER $CRYPT_PATH -q -b 1M -k $CRYPT_KEY -i $CRYPT_INPLACE_FILE
+done
+if cmp -s $CRYPT_INPLACE_REF $CRYPT_INPLACE_FILE; then
+    echo "[!] Throttled in place run was not interrupted"
+    exit 1
+fi
+$CRYPT_PATH -q -k $CRYPT_KEY -i $CRYPT_INPLACE_FILE
+if ! cmp -s $CRYPT_INPLACE_REF $CRYPT_INPLACE_FILE; then
+    echo "[!] Resumed in place output does not match an uninterrupted run"
+    exit 1
+fi
+rm -f $CRYPT_INPLACE_FILE $CRYPT_INPLACE_JOURNAL $CRYPT_INPLACE_REF $CRYPT_INPLACE_SRC
+
+echo "[+] Testing crypt with compression, stdin to file and back"
+CRYPT_Z_FILE="../test_files/z.dat"
+CRYPT_UNZ_FILE="../test_files/unz.dat"
+rm -f $CRYPT_Z_FILE $CRYPT_UNZ_FILE
+echo "crypt -k $CRYPT_KEY -z -o $CRYPT_Z_FILE < $CRYPT_IN_FILE"
+$CRYPT_PATH -k $CRYPT_KEY -z -o $CRYPT_Z_FILE < $CRYPT_IN_FILE
+echo "crypt -k $CRYPT_KEY -d -o $CRYPT_UNZ_FILE $CRYPT_Z_FILE"
+$CRYPT_PATH -k $CRYPT_KEY -d -o $CRYPT_UNZ_FILE $CRYPT_Z_FILE
+if ! cmp -s $CRYPT_IN_FILE $CRYPT_UNZ_FILE; then
+    echo "[!] Compression round trip failed"
+    exit 1
+fi
+rm -f $CRYPT_Z_FILE $CRYPT_UNZ_FILE
+
+echo "[+] Testing crypt compression of the largest accepted incompressible input file"
+CRYPT_Z_IN_FILE="../test_files/z_in.dat"
+head -c 65524 /dev/urandom > $CRYPT_Z_IN_FILE
+$CRYPT_PATH -q -k $CRYPT_KEY -z -o $CRYPT_Z_FILE $CRYPT_Z_IN_FILE
+$CRYPT_PATH -q -k $CRYPT_KEY -d -o $CRYPT_UNZ_FILE $CRYPT_Z_FILE
+if ! cmp -s $CRYPT_Z_IN_FILE $CRYPT_UNZ_FILE; then
+    echo "[!] Compression round trip of a 65524 byte file failed"
+    exit 1
+fi
+head -c 65525 /dev/urandom > $CRYPT_Z_IN_FILE
+if $CRYPT_PATH -q -k $CRYPT_KEY -z -o $CRYPT_Z_FILE.big $CRYPT_Z_IN_FILE 2>/dev/null; then
+    echo "[!] -z accepted an input file whose output -d cannot read"
+    exit 1
+fi
+rm -f $CRYPT_Z_IN_FILE $CRYPT_Z_FILE $CRYPT_Z_FILE.big $CRYPT_UNZ_FILE
+
+echo "[+] Testing crypt record mode, encrypt records and decrypt one of them"
+CRYPT_REC_FILE="../test_files/records.dat"
+CRYPT_REC_ENC_FILE="../test_files/records.enc"
+CRYPT_REC_INDEX_FILE="../test_files/records.idx"
+rm -f $CRYPT_REC_FILE $CRYPT_REC_ENC_FILE $CRYPT_REC_INDEX_FILE
+for i in $(seq 1 64); do
+    generate_random_ascii_string $i >> $CRYPT_REC_FILE
+done
+echo "crypt -k $CRYPT_KEY -r $CRYPT_REC_INDEX_FILE -o $CRYPT_REC_ENC_FILE < $CRYPT_REC_FILE"
+$CRYPT_PATH -k $CRYPT_KEY -r $CRYPT_REC_INDEX_FILE -o $CRYPT_REC_ENC_FILE < $CRYPT_REC_FILE
+echo "crypt -k $CRYPT_KEY -r $CRYPT_REC_INDEX_FILE -n 41 $CRYPT_REC_ENC_FILE"
+if [ "$($CRYPT_PATH -q -k $CRYPT_KEY -r $CRYPT_REC_INDEX_FILE -n 41 $CRYPT_REC_ENC_FILE)" != "$(sed -n 42p $CRYPT_REC_FILE)" ]; then
+    echo "[!] Record extraction failed"
+    exit 1
+fi
+for CRYPT_REC_BAD in 64 1537228672809129302 -1; do
+    if $CRYPT_PATH -q -k $CRYPT_KEY -r $CRYPT_REC_INDEX_FILE -n $CRYPT_REC_BAD $CRYPT_REC_ENC_FILE 2>/dev/null; then
+        echo "[!] Record $CRYPT_REC_BAD is not in the index but extraction succeeded"
+        exit 1
+    fi
+done
+
+echo "[+] Testing crypt record mode twice, an existing index must be refused and left intact"
+CRYPT_REC_FILE2="../test_files/records2.dat"
+printf "alpha\nbravo\ncharlie\n" > $CRYPT_REC_FILE2
+if $CRYPT_PATH -q -k $CRYPT_KEY -r $CRYPT_REC_INDEX_FILE -o $CRYPT_REC_ENC_FILE < $CRYPT_REC_FILE2; then
+    echo "[!] Record mode appended to an existing index"
+    exit 1
+fi
+if [ "$($CRYPT_PATH -q -k $CRYPT_KEY -r $CRYPT_REC_INDEX_FILE -n 3 $CRYPT_REC_ENC_FILE)" != "$(sed -n 4p $CRYPT_REC_FILE)" ]; then
+    echo "[!] Refused record run changed the index or output"
+    exit 1
+fi
+
+echo "[+] Testing crypt record mode with a new index truncates an existing output"
+rm -f $CRYPT_REC_INDEX_FILE
+$CRYPT_PATH -q -k $CRYPT_KEY -r $CRYPT_REC_INDEX_FILE -o $CRYPT_REC_ENC_FILE < $CRYPT_REC_FILE2
+if [ "$($CRYPT_PATH -q -k $CRYPT_KEY -r $CRYPT_REC_INDEX_FILE -n 1 $CRYPT_REC_ENC_FILE)" != "bravo" ] ||
+        [ "$(stat -c %s $CRYPT_REC_ENC_FILE)" != "$(stat -c %s $CRYPT_REC_FILE2)" ]; then
+    echo "[!] Second record run did not start a new stream"
+    exit 1
+fi
+rm -f $CRYPT_REC_FILE $CRYPT_REC_FILE2 $CRYPT_REC_ENC_FILE $CRYPT_REC_INDEX_FILE
+
+echo "[+] Testing crypt fan-out, one input under two keys must match two single-key runs"
+CRYPT_KEY2=$(generate_random_ascii_string 17)
+CRYPT_FAN_OUT1="../test_files/fan1.dat"
+CRYPT_FAN_OUT2="../test_files/fan2.dat"
+CRYPT_SINGLE_OUT2="../test_files/single2.dat"
+rm -f $CRYPT_FAN_OUT1 $CRYPT_FAN_OUT2 $CRYPT_SINGLE_OUT2
+echo "crypt -k $CRYPT_KEY -o $CRYPT_FAN_OUT1 -k $CRYPT_KEY2 -o $CRYPT_FAN_OUT2 $CRYPT_IN_FILE"
+$CRYPT_PATH -k $CRYPT_KEY -o $CRYPT_FAN_OUT1 -k $CRYPT_KEY2 -o $CRYPT_FAN_OUT2 $CRYPT_IN_FILE
+$CRYPT_PATH -q -k $CRYPT_KEY2 -o $CRYPT_SINGLE_OUT2 $CRYPT_IN_FILE
+if ! cmp -s $CRYPT_FAN_OUT1 $CRYPT_OUT_FILE || ! cmp -s $CRYPT_FAN_OUT2 $CRYPT_SINGLE_OUT2; then
+    echo "[!] Fan-out output does not match single key output"
+    exit 1
+fi
+
+echo "[+] Testing crypt fan-out with the first key written to stdout"
+echo "crypt -k $CRYPT_KEY -o - -k $CRYPT_KEY2 -o $CRYPT_FAN_OUT2 $CRYPT_IN_FILE"
+rm -f $CRYPT_FAN_OUT2
+$CRYPT_PATH -q -k $CRYPT_KEY -o - -k $CRYPT_KEY2 -o $CRYPT_FAN_OUT2 $CRYPT_IN_FILE > $CRYPT_FAN_OUT1
+if ! cmp -s $CRYPT_FAN_OUT1 $CRYPT_OUT_FILE || ! cmp -s $CRYPT_FAN_OUT2 $CRYPT_SINGLE_OUT2; then
+    echo "[!] Fan-out output to stdout does not match single key output"
+    exit 1
+fi
+
+echo "[+] Testing crypt fan-out refuses the same output for two keys"
+rm -f $CRYPT_FAN_OUT2
+if $CRYPT_PATH -q -k $CRYPT_KEY -o $CRYPT_FAN_OUT2 -k $CRYPT_KEY2 -o $CRYPT_FAN_OUT2 $CRYPT_IN_FILE || [ -f $CRYPT_FAN_OUT2 ]; then
+    echo "[!] Fan-out accepted one output file for two keys"
+    exit 1
+fi
+rm -f $CRYPT_FAN_OUT1 $CRYPT_FAN_OUT2 $CRYPT_SINGLE_OUT2
+
+echo "[+] Testing crypt with bandwidth limit and idle priority"
+CRYPT_THROTTLE_OUT="../test_files/throttle.dat"
+rm -f $CRYPT_THROTTLE_OUT
+echo "crypt -b 64K -p idle -k $CRYPT_KEY -o $CRYPT_THROTTLE_OUT $CRYPT_IN_FILE"
+$CRYPT_PATH -b 64K -p idle -k $CRYPT_KEY -o $CRYPT_THROTTLE_OUT $CRYPT_IN_FILE
+if ! cmp -s $CRYPT_THROTTLE_OUT $CRYPT_OUT_FILE; then
+    echo "[!] Throttled output does not match"
+    exit 1
+fi
+rm -f $CRYPT_THROTTLE_OUT
+
 echo "[+] Tests successful"
\ No newline at end of file